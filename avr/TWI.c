@@ -0,0 +1,501 @@
+/*
+ * TWI driver for an ATMEGA328 (really any AVR with TWI hardware).
+ *
+ * Interrupt-driven: callers queue transaction descriptors and the
+ * TWI_vect handler walks each one through the bus protocol. Some
+ * ideas from Peter Fleury's code:
+ *
+ *    http://code.google.com/p/freecockpit/source/browse/software_avr/hwmaster_mega8/twimaster.c
+ *
+ * (C)opyright 2010 Peter Gammie, peteg42 at gmail dot com. All rights reserved.
+ * Commenced September 2010.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef F_CPU
+#error "Please define the cpu frequency F_CPU"
+#endif
+
+#include <stddef.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include <util/twi.h>
+
+#include "TWI.h"
+
+/* **************************************** */
+
+/* The TWI pins on an ATMEGA328. */
+#define TWI_PORT PORTC
+#define TWI_PIN  PINC
+#define TWI_DDR  DDRC
+#define TWI_SDA  _BV(PC4)
+#define TWI_SCL  _BV(PC5)
+
+/* Acknowledge the interrupt and keep going. */
+#define TWCR_GO (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+/* Timer0 overflows before we give up on a transaction. */
+#define TWI_TIMEOUT_OVF ((uint8_t)((TWI_TIMEOUT_MS * (F_CPU / 1000)) / (256UL * TWI_TIMER_PRESCALE) + 1))
+
+/* The transaction on the bus is at the head of the queue. */
+static struct TWI_txn_t * volatile head;
+static struct TWI_txn_t *tail;
+
+/* Bytes written (after the register number) or read so far. */
+static uint8_t idx;
+
+/* Timer0 overflows since the head transaction started. */
+static uint8_t ovf;
+
+struct TWI_device_t {
+  struct TWI_stats_t stats;
+  uint16_t speed; /* 0: use default_speed. */
+};
+
+static struct TWI_device_t devices[TWI_MAX_DEVICES];
+
+static uint16_t default_speed;
+
+/* **************************************** */
+
+/* Find (or allocate) the record for a device. Returns NULL if the
+   table is full. Interrupts must be off. */
+static struct TWI_device_t *
+TWI_device(uint8_t addr)
+{
+  for(uint8_t i = 0; i < TWI_MAX_DEVICES; i++) {
+    if(devices[i].stats.addr == addr) {
+      return &devices[i];
+    }
+    if(devices[i].stats.addr == 0) {
+      devices[i].stats.addr = addr;
+      return &devices[i];
+    }
+  }
+
+  return NULL;
+}
+
+static inline void
+TWI_timer_start(void)
+{
+  power_timer0_enable();
+  TCCR0A = 0;
+  TIMSK0 = _BV(TOIE0);
+}
+
+static inline void
+TWI_timer_stop(void)
+{
+  TCCR0B = 0;
+  TIMSK0 = 0;
+  power_timer0_disable();
+}
+
+/* Restart the clock for the head transaction. */
+static inline void
+TWI_timer_reset(void)
+{
+  TCCR0B = 0;
+  TCNT0 = 0;
+  TIFR0 = _BV(TOV0);
+  ovf = 0;
+  /* clk/64. */
+  TCCR0B = _BV(CS01) | _BV(CS00);
+}
+
+/* Bounded wait for a STOP to go out. A START issued while a STOP is
+   still pending gets lost; if a slave is holding the bus the timeout
+   will catch it. */
+static inline void
+TWI_stop_wait(void)
+{
+  for(uint8_t i = 0; (TWCR & _BV(TWSTO)) && i < 255; i++)
+    ;
+}
+
+/* Set up for the head transaction. The bit rate can only change
+   between a STOP and the next START. */
+static inline void
+TWI_begin(void)
+{
+  struct TWI_device_t *dev = TWI_device(head->addr);
+  uint16_t speed = dev != NULL && dev->speed != 0 ? dev->speed : default_speed;
+
+  idx = 0;
+  head->status = TWI_BUSY;
+  head->twsr = TW_NO_INFO;
+  TWI_timer_reset();
+
+  TWI_stop_wait();
+  TWSR = speed >> 8;
+  TWBR = speed & 0xFF;
+}
+
+/* Retire the head transaction and start the next one, if any. */
+static void
+TWI_finish(TWI_status_t status)
+{
+  struct TWI_txn_t *txn = head;
+  struct TWI_device_t *d = TWI_device(txn->addr);
+
+  if(d != NULL) {
+    struct TWI_stats_t *dev = &d->stats;
+    uint16_t latency = ((uint16_t)ovf << 8) | TCNT0;
+
+    dev->transactions++;
+    if(status == TWI_TIMEOUT) {
+      dev->timeouts++;
+    } else if(status != TWI_DONE) {
+      dev->errors++;
+    }
+    dev->latency_last = latency;
+    if(latency > dev->latency_max) {
+      dev->latency_max = latency;
+    }
+  }
+
+  head = txn->next;
+  if(head == NULL) {
+    tail = NULL;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    TWI_timer_stop();
+  } else {
+    /* Let the STOP go out and then START the next. */
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    TWI_begin();
+    TWCR = TWCR_GO | _BV(TWSTA);
+  }
+
+  txn->status = status;
+  if(txn->done != NULL) {
+    txn->done(txn);
+  }
+}
+
+/* Advance the head transaction by one bus event. TWINT must be set. */
+static void
+TWI_step(void)
+{
+  struct TWI_txn_t *txn = head;
+  uint8_t twsr = TW_STATUS;
+
+  if(txn == NULL) {
+    /* Spurious. Let go of the bus. */
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    return;
+  }
+
+  switch(twsr) {
+  case TW_START:
+    TWDR = txn->addr | TW_WRITE;
+    TWCR = TWCR_GO;
+    break;
+
+  case TW_REP_START:
+    TWDR = txn->addr | TW_READ;
+    TWCR = TWCR_GO;
+    break;
+
+  case TW_MT_SLA_ACK:
+    TWDR = txn->reg;
+    TWCR = TWCR_GO;
+    break;
+
+  case TW_MT_DATA_ACK:
+    if(idx < txn->wlen) {
+      TWDR = txn->wbuf[idx++];
+      TWCR = TWCR_GO;
+    } else if(txn->rlen > 0) {
+      idx = 0;
+      TWCR = TWCR_GO | _BV(TWSTA);
+    } else {
+      TWI_finish(TWI_DONE);
+    }
+    break;
+
+  case TW_MR_SLA_ACK:
+    /* NACK the last byte. */
+    TWCR = TWCR_GO | (txn->rlen > 1 ? _BV(TWEA) : 0);
+    break;
+
+  case TW_MR_DATA_ACK:
+    txn->rbuf[idx++] = TWDR;
+    TWCR = TWCR_GO | (idx + 1 < txn->rlen ? _BV(TWEA) : 0);
+    break;
+
+  case TW_MR_DATA_NACK:
+    txn->rbuf[idx] = TWDR;
+    TWI_finish(TWI_DONE);
+    break;
+
+  default:
+    /* SLA or data NACKed, arbitration lost, bus error. */
+    txn->twsr = twsr;
+    TWI_finish(TWI_ERROR);
+    break;
+  }
+}
+
+/* A Timer0 overflow while a transaction is on the bus. */
+static void
+TWI_tick(void)
+{
+  if(head != NULL && ++ovf >= TWI_TIMEOUT_OVF) {
+    TWI_recover();
+    TWI_finish(TWI_TIMEOUT);
+  }
+}
+
+ISR(TWI_vect)
+{
+  TWI_step();
+}
+
+ISR(TIMER0_OVF_vect)
+{
+  TWI_tick();
+}
+
+/* **************************************** */
+
+void
+TWI_recover(void)
+{
+  /* Take the pins back from the TWI hardware. Emulate open-drain
+     outputs: a line is released (and pulled up externally) when it is
+     an input, and driven low when it is an output. */
+  TWCR = 0;
+  TWI_PORT &= ~(TWI_SDA | TWI_SCL);
+  TWI_DDR &= ~(TWI_SDA | TWI_SCL);
+
+  /* Nine clocks is enough for a slave to finish shifting out whatever
+     byte it is stuck in and see a NACK. */
+  for(uint8_t i = 0; i < 9; i++) {
+    TWI_DDR |= TWI_SCL;
+    _delay_us(5);
+    TWI_DDR &= ~TWI_SCL;
+    _delay_us(5);
+  }
+
+  /* STOP: SDA rises while SCL is high. */
+  TWI_DDR |= TWI_SCL;
+  TWI_DDR |= TWI_SDA;
+  _delay_us(5);
+  TWI_DDR &= ~TWI_SCL;
+  _delay_us(5);
+  TWI_DDR &= ~TWI_SDA;
+  _delay_us(5);
+}
+
+bool
+TWI_submit(struct TWI_txn_t *txn)
+{
+  bool queued = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(txn->status != TWI_QUEUED && txn->status != TWI_BUSY) {
+      txn->status = TWI_QUEUED;
+      txn->next = NULL;
+
+      if(tail == NULL) {
+        head = tail = txn;
+        TWI_timer_start();
+        TWI_begin();
+        TWCR = TWCR_GO | _BV(TWSTA);
+      } else {
+        tail->next = txn;
+        tail = txn;
+      }
+
+      queued = true;
+    }
+  }
+
+  return queued;
+}
+
+static inline bool
+TWI_pending(struct TWI_txn_t *txn)
+{
+  return txn->status == TWI_QUEUED || txn->status == TWI_BUSY;
+}
+
+bool
+TWI_wait(struct TWI_txn_t *txn)
+{
+  if(SREG & _BV(SREG_I)) {
+    /* The TWI and Timer0 keep running in idle mode. The instruction
+       after sei() always executes, so we cannot miss the wakeup. */
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    while(TWI_pending(txn)) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      cli();
+    }
+    sei();
+  } else {
+    /* Early initialisation: drive the state machine by hand. */
+    while(TWI_pending(txn)) {
+      if(TWCR & _BV(TWINT)) {
+        TWI_step();
+      } else if(TIFR0 & _BV(TOV0)) {
+        TIFR0 = _BV(TOV0);
+        TWI_tick();
+      }
+    }
+  }
+
+  return txn->status == TWI_DONE;
+}
+
+bool
+TWI_busy(void)
+{
+  return head != NULL;
+}
+
+void
+TWI_drain(void)
+{
+  /* Sleep between interrupts, as TWI_wait() does. */
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  while(TWI_busy()) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  sei();
+  TWI_stop_wait();
+}
+
+bool
+TWI_get_stats(uint8_t i, struct TWI_stats_t *s)
+{
+  bool found = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(i < TWI_MAX_DEVICES && devices[i].stats.addr != 0) {
+      *s = devices[i].stats;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+void
+TWI_set_default_speed(uint16_t speed)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    default_speed = speed;
+  }
+}
+
+bool
+TWI_set_speed(uint8_t addr, uint16_t speed)
+{
+  bool found = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    struct TWI_device_t *dev = TWI_device(addr);
+    if(dev != NULL) {
+      dev->speed = speed;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+/* **************************************** */
+
+bool
+TWI_transfer(struct TWI_txn_t *txn)
+{
+  uint8_t backoff = TWI_BACKOFF_MS;
+
+  for(uint8_t tries = 1; ; tries++) {
+    if(TWI_submit(txn) && TWI_wait(txn)) {
+      return true;
+    }
+
+    if(tries == TWI_MAX_TRIES) {
+      return false;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      struct TWI_device_t *dev = TWI_device(txn->addr);
+      if(dev != NULL) {
+        dev->stats.retries++;
+      }
+    }
+
+    /* A busy device (e.g. mid-conversion) needs time, not hammering. */
+    for(uint8_t i = 0; i < backoff; i++) {
+      _delay_ms(1);
+    }
+    backoff <<= 1;
+  }
+}
+
+bool
+TWI_read_regs(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+{
+  struct TWI_txn_t txn = {
+    .addr = addr,
+    .reg = reg,
+    .rbuf = buf,
+    .rlen = len,
+  };
+
+  return TWI_transfer(&txn);
+}
+
+bool
+TWI_write_regs(uint8_t addr, uint8_t reg, const uint8_t *buf, uint8_t len)
+{
+  struct TWI_txn_t txn = {
+    .addr = addr,
+    .reg = reg,
+    .wbuf = buf,
+    .wlen = len,
+  };
+
+  return TWI_transfer(&txn);
+}
@@ -1,8 +1,9 @@
 /*
  * TWI driver for an ATMEGA328 (really any AVR with TWI hardware).
  *
- * Synchronous, no interrupts in sight. Some ideas from Peter Fleury's
- * code:
+ * Interrupt-driven: callers queue transaction descriptors and the
+ * TWI_vect handler walks each one through the bus protocol. Some
+ * ideas from Peter Fleury's code:
  *
  *    http://code.google.com/p/freecockpit/source/browse/software_avr/hwmaster_mega8/twimaster.c
  *
@@ -37,100 +38,165 @@
 #ifndef _TWI_H_
 #define _TWI_H_
 
-#include <avr/io.h>
-#include <util/twi.h>
-
-typedef enum { READ, WRITE } rw_t;
-
-/* **************************************** */
-
-static inline void
-TWI_wait_int(uint8_t *twsr) {
-  while(!(TWCR & _BV(TWINT)))
-    ;
-  *twsr = TW_STATUS & TW_STATUS_MASK;
-}
-
-/* Send a START condition to the bus and wait for TWINT to be set. */
-static inline bool
-TWI_send_start(uint8_t *twsr)
-{
-  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
-  TWI_wait_int(twsr);
-
-  /* START or REPEATED_START are both OK. */
-  return *twsr == TW_START || *twsr == TW_REP_START;
-}
-
-static inline void
-TWI_send_stop(uint8_t *twsr)
-{
-  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
-  while(TWCR & _BV(TWSTO))
-    ;
-}
+#include <stdbool.h>
+#include <stdint.h>
 
 /* **************************************** */
 
-/* Read data from the previously addressed device. */
-static inline bool
-TWI_read(uint8_t *twsr, uint8_t *data, bool ack)
-{
-  TWCR = _BV(TWINT) | _BV(TWEN) | (ack ? _BV(TWEA) : 0);
-  TWI_wait_int(twsr);
-  *data = TWDR;
-
-  return *twsr == (ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
-}
+/* Synchronous transfers are attempted this many times... */
+#ifndef TWI_MAX_TRIES
+#define TWI_MAX_TRIES 4
+#endif
 
-/* Send data to the previously addressed device. */
-static inline bool
-TWI_write(uint8_t *twsr, uint8_t data)
-{
-  TWDR = data;
-  TWCR = _BV(TWINT) | _BV(TWEN);
-  TWI_wait_int(twsr);
+/* ... backing off for this long, doubling after each failure. */
+#ifndef TWI_BACKOFF_MS
+#define TWI_BACKOFF_MS 1
+#endif
 
-  return *twsr == TW_MT_DATA_ACK;
-}
+/* A transaction that takes longer than this is abandoned and the bus
+   recovered. */
+#ifndef TWI_TIMEOUT_MS
+#define TWI_TIMEOUT_MS 100
+#endif
 
-static inline bool
-TWI_start(uint8_t slave_addr, uint8_t *twsr, rw_t rw)
-{
-  if(TWI_send_start(twsr)) {
-    /* Send slave (chip) address. */
-    TWDR = slave_addr | (rw == READ ? TW_READ : TW_WRITE);
-    TWCR = _BV(TWINT) | _BV(TWEN);
-    TWI_wait_int(twsr);
+/* Transactions are timed with Timer0 at this prescaler. */
+#define TWI_TIMER_PRESCALE 64
 
-    return *twsr == TW_MR_SLA_ACK || *twsr == TW_MT_SLA_ACK;
-  }
+/* The number of devices we keep statistics and speeds for. */
+#define TWI_MAX_DEVICES 4
 
-  return false;
-}
+/* **************************************** */
+/* Bit rate solver.
+ *
+ *   SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+ *
+ * Pick the smallest prescaler that gets TWBR into 8 bits. Both
+ * divisions round up, so SCL never exceeds the rate asked for: slaves
+ * such as the DS1307 are only specified up to 100kHz. Asking for
+ * more than F_CPU can deliver (F_CPU / (16 + 2 * TWI_TWBR_MIN)) yields
+ * the fastest rate with TWBR = TWI_TWBR_MIN; e.g. at 1MHz that's
+ * about 27.8kHz, and 400kHz needs at least 14.4MHz. All of this is
+ * constant-folded, and also works in #if.
+ */
 
-static inline bool
-TWI_start_wait(uint8_t slave_addr, rw_t rw)
-{
-  while(1) {
-  //for(uint8_t i = 0; i < MAX_TRIES; i++) {
-    uint8_t twsr;
-
-    if(TWI_start(slave_addr, &twsr, rw)) {
-    	return twsr == TW_MR_SLA_ACK || twsr == TW_MT_SLA_ACK;
-    } else if(twsr == TW_MT_SLA_NACK || twsr == TW_MR_DATA_NACK) {
-      /* The device is busy, send stop condition to terminate the operation. */
-      TWI_send_stop(&twsr);
-    }
-  }
-
-  return false;
-}
+/* Older AVR datasheets ask for TWBR >= 10 in master mode. Must be > 0. */
+#ifndef TWI_TWBR_MIN
+#define TWI_TWBR_MIN 10
+#endif
+
+#define TWI_DIV_UP(n, d)      (((n) + (d) - 1) / (d))
+#define TWI_DIV(scl)          TWI_DIV_UP(F_CPU, (scl))
+#define TWI_TOO_FAST(scl)     (TWI_DIV(scl) < 16 + 2 * TWI_TWBR_MIN)
+#define TWI_TWBR_PS(scl, ps)  TWI_DIV_UP(TWI_DIV(scl) - 16, 2UL << (2 * (ps)))
+
+#define TWI_TWPS(scl)                           \
+  (  TWI_TOO_FAST(scl)             ? 0          \
+   : TWI_TWBR_PS(scl, 0) <= 255    ? 0          \
+   : TWI_TWBR_PS(scl, 1) <= 255    ? 1          \
+   : TWI_TWBR_PS(scl, 2) <= 255    ? 2          \
+   :                                 3)
+
+#define TWI_TWBR(scl)                                   \
+  (  TWI_TOO_FAST(scl)                  ? TWI_TWBR_MIN  \
+   : TWI_TWBR_PS(scl, TWI_TWPS(scl)) > 255 ? 255        \
+   :                                     TWI_TWBR_PS(scl, TWI_TWPS(scl)))
+
+/* TWPS in the high byte, TWBR in the low. */
+#define TWI_SPEED(scl) ((uint16_t)((TWI_TWPS(scl) << 8) | TWI_TWBR(scl)))
+
+typedef enum {
+  TWI_IDLE = 0,  /* Never submitted. */
+  TWI_QUEUED,    /* Waiting for the bus. */
+  TWI_BUSY,      /* On the bus. */
+  TWI_DONE,      /* Completed successfully. */
+  TWI_ERROR,     /* Failed, see twsr. */
+  TWI_TIMEOUT,   /* The bus stopped making progress and was recovered. */
+} TWI_status_t;
+
+struct TWI_txn_t;
+
+/* Called from the TWI interrupt handler when a transaction completes
+   or fails. Keep it short. It may submit further transactions. */
+typedef void (*TWI_callback_t)(struct TWI_txn_t *txn);
+
+/* A register transfer: address the device, send the register number
+ * followed by wlen bytes from wbuf, then if rlen > 0 issue a repeated
+ * START and read rlen bytes into rbuf.
+ *
+ * The descriptor must stay put (and unmodified) until its status is
+ * TWI_DONE or TWI_ERROR. Embed it in a larger struct to pass context
+ * to the callback.
+ */
+struct TWI_txn_t {
+  uint8_t addr;        /* Shifted left 1, as the LSB is the read/write bit. */
+  uint8_t reg;
+  const uint8_t *wbuf;
+  uint8_t wlen;
+  uint8_t *rbuf;
+  uint8_t rlen;
+  TWI_callback_t done; /* Optional. */
+
+  /* Managed by the driver. */
+  volatile TWI_status_t status;
+  uint8_t twsr;        /* The TWI status code that caused an error. */
+  struct TWI_txn_t *next;
+};
+
+/* Queue a transaction and return immediately. Returns false if the
+   descriptor is already queued or on the bus. */
+bool TWI_submit(struct TWI_txn_t *txn);
+
+/* Wait for a submitted transaction to complete, idle-sleeping if
+   interrupts are enabled and polling the hardware otherwise. Returns
+   true on success. */
+bool TWI_wait(struct TWI_txn_t *txn);
+
+/* Is a transaction queued or on the bus? */
+bool TWI_busy(void);
+
+/* Wait for the queue to empty and the final STOP to go out. Interrupts
+   must be enabled. */
+void TWI_drain(void);
+
+/* The bus speed (from TWI_SPEED()) for devices without one of their
+   own. */
+void TWI_set_default_speed(uint16_t speed);
+
+/* The bus speed to use for transactions with the device at addr. */
+bool TWI_set_speed(uint8_t addr, uint16_t speed);
+
+/* Clock SCL nine times to free a slave holding SDA low, then send a
+   STOP. Leaves the TWI hardware disabled; the next transaction
+   re-enables it. */
+void TWI_recover(void);
+
+/* Per-device statistics. Latencies are in units of TWI_TIMER_PRESCALE
+   CPU cycles. The counters wrap. */
+struct TWI_stats_t {
+  uint8_t addr;
+  uint16_t transactions;
+  uint16_t errors;
+  uint16_t timeouts;
+  uint16_t retries;
+  uint16_t latency_last;
+  uint16_t latency_max;
+};
+
+/* Copy out the statistics for the i'th device we have talked to.
+   Returns false if there is no such device. */
+bool TWI_get_stats(uint8_t i, struct TWI_stats_t *stats);
+
+/* Submit, wait and retry with backoff up to TWI_MAX_TRIES times. */
+bool TWI_transfer(struct TWI_txn_t *txn);
+
+/* Synchronous register reads and writes. */
+bool TWI_read_regs(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
+bool TWI_write_regs(uint8_t addr, uint8_t reg, const uint8_t *buf, uint8_t len);
 
 static inline bool
-TWI_rep_start(uint8_t slave_addr, uint8_t *twsr, rw_t rw)
+TWI_write_reg(uint8_t addr, uint8_t reg, uint8_t v)
 {
-  return TWI_start(slave_addr, twsr, rw);
+  return TWI_write_regs(addr, reg, &v, 1);
 }
 
 #endif /* _TWI_H_ */
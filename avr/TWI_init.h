@@ -3,8 +3,7 @@
  *
  * Initialisation routines.
  *
- * Synchronous, no interrupts in sight. Some ideas from Peter Fleury's
- * code:
+ * Some ideas from Peter Fleury's code:
  *
  *    http://code.google.com/p/freecockpit/source/browse/software_avr/hwmaster_mega8/twimaster.c
  *
@@ -40,13 +39,17 @@
 #define _TWI_INIT_H_
 
 #include <avr/io.h>
+#include <avr/power.h>
 #include <util/twi.h>
 
+#include "TWI.h"
+
 #ifndef F_CPU
 #error "Please define the cpu frequency F_CPU"
 #endif
 
-/* TWI clock in Hz. 400kHz is the limit. With a 1MHz clock try ~ 10kHz. */
+/* Default TWI clock in Hz, for devices that haven't asked for their
+   own with TWI_set_speed(). */
 #ifndef SCL_CLOCK
 #error "Please define the TWI clock frequency SCL_CLOCK"
 #endif
@@ -57,24 +60,18 @@ TWI_init(void)
   /* Fire up the TWI module. */
   power_twi_enable();
 
-  /* TWI timing: prescaler: 1. */
-  TWSR = 0;
-
-  // FIXME for a 1MHz AVR clock / 400kHz TWI clock:
-  //    TWI.h:157: warning: large integer implicitly truncated to unsigned type
-  // FIXME SCL frequency = 1159200 / (16 + 2 * 47 * 1) = 98.743 khz
-#if (F_CPU / SCL_CLOCK - 16) / 2 <= 10
-#error (F_CPU / SCL_CLOCK - 16) / 2 should be > 10 for stable operation
-#endif
-  TWBR = (F_CPU / SCL_CLOCK - 16) / 2;
+  /* The bit rate is set before each transaction starts. */
+  TWI_set_default_speed(TWI_SPEED(SCL_CLOCK));
 
   /* Don't bother setting the TWAR - slave address register. */
 }
 
-/* FIXME useful? */
+/* Stopping the clock mid-transaction would wedge the bus. Interrupts
+   must be enabled. */
 static inline void
 TWI_turn_off(void)
 {
+  TWI_drain();
   power_twi_disable();
 }
 
@@ -0,0 +1,198 @@
+/*
+ * Alarms, kept sorted by time of day in the DS1307's NVRAM.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "alarms.h"
+#include "clock.h"
+#include "ds1307.h"
+#include "nvram.h"
+
+/* **************************************** */
+
+static uint8_t count;
+static struct alarm_t alarms[ALARMS_MAX];
+
+/* The time of day of the last check, valid if checked. */
+static bool checked;
+static uint32_t last_seconds;
+
+static inline uint32_t
+alarm_seconds(const struct alarm_t *a)
+{
+  return a->hours * 3600UL + a->minutes * 60UL;
+}
+
+static inline bool
+alarm_valid(const struct alarm_t *a)
+{
+  return a->hours < 24 && a->minutes < 60 && !(a->days & ~ALARM_EVERY_DAY);
+}
+
+/* One burst: magic, count, table. */
+static bool
+alarms_save(void)
+{
+  uint8_t buf[NVRAM_ALARMS_LEN];
+
+  buf[0] = NVRAM_MAGIC;
+  buf[1] = count;
+  memcpy(&buf[2], alarms, count * sizeof(struct alarm_t));
+
+  return ds1307_nvram_write(NVRAM_ALARMS, buf, 2 + count * sizeof(struct alarm_t));
+}
+
+/* **************************************** */
+
+void
+alarms_load(void)
+{
+  uint8_t buf[2];
+
+  count = 0;
+  if(!ds1307_nvram_read(NVRAM_ALARMS, buf, sizeof(buf))
+     || buf[0] != NVRAM_MAGIC || buf[1] > ALARMS_MAX) {
+    return;
+  }
+
+  if(buf[1] > 0
+     && !ds1307_nvram_read(NVRAM_ALARMS + 2, (uint8_t *)alarms, buf[1] * sizeof(struct alarm_t))) {
+    return;
+  }
+  count = buf[1];
+
+  for(uint8_t i = 0; i < count; i++) {
+    if(!alarm_valid(&alarms[i])
+       || (i > 0 && alarm_seconds(&alarms[i]) < alarm_seconds(&alarms[i - 1]))) {
+      count = 0;
+      return;
+    }
+  }
+}
+
+uint8_t
+alarms_count(void)
+{
+  return count;
+}
+
+bool
+alarm_get(uint8_t i, struct alarm_t *a)
+{
+  if(i >= count) {
+    return false;
+  }
+
+  *a = alarms[i];
+  return true;
+}
+
+bool
+alarm_add(const struct alarm_t *a)
+{
+  uint8_t i;
+
+  if(count == ALARMS_MAX || !alarm_valid(a)) {
+    return false;
+  }
+
+  /* Insertion sort, from the end. */
+  for(i = count; i > 0 && alarm_seconds(&alarms[i - 1]) > alarm_seconds(a); i--) {
+    alarms[i] = alarms[i - 1];
+  }
+  alarms[i] = *a;
+  count++;
+
+  return alarms_save();
+}
+
+bool
+alarm_remove(uint8_t i)
+{
+  if(i >= count) {
+    return false;
+  }
+
+  count--;
+  for(; i < count; i++) {
+    alarms[i] = alarms[i + 1];
+  }
+
+  return alarms_save();
+}
+
+/* **************************************** */
+
+/* Is a a little earlier than b? The SRAM clock running fast, not a
+   day going by. */
+static inline bool
+behind(uint32_t a, uint32_t b)
+{
+  return (b + CLOCK_SECONDS_PER_DAY - a) % CLOCK_SECONDS_PER_DAY
+    < CLOCK_RESYNC_MINUTES * 60UL;
+}
+
+/* Is there an alarm in the window (from, to], which may span midnight?
+   day is the day of the week at to. */
+static bool
+alarms_due(uint32_t from, uint32_t to, uint8_t day)
+{
+  uint8_t yesterday = day == 1 ? 7 : day - 1;
+
+  for(uint8_t i = 0; i < count; i++) {
+    uint32_t s = alarm_seconds(&alarms[i]);
+
+    if(from <= to) {
+      if(from < s && s <= to && (alarms[i].days & _BV(day - 1))) {
+        return true;
+      }
+    } else {
+      if((from < s && (alarms[i].days & _BV(yesterday - 1)))
+         || (s <= to && (alarms[i].days & _BV(day - 1)))) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+bool
+alarms_check(void)
+{
+  uint32_t now;
+  uint8_t day;
+  bool rang = false;
+
+  /* We're called from check_alarm(), on the housekeeping timer. */
+  if(clock_stale()) {
+    clock_sync(true);
+  }
+
+  if(!clock_now(&now, &day)) {
+    return false;
+  }
+
+  if(checked && alarms_due(last_seconds, now, day)) {
+    /* The SRAM clock can be a bit off, so ask the DS1307. If it says
+       it's too early, leave the window open for next time. If we can't
+       ask, go with what we have. */
+    rang = true;
+    if(clock_sync(true) && clock_now(&now, &day)) {
+      if(behind(now, last_seconds) || !alarms_due(last_seconds, now, day)) {
+        return false;
+      }
+    }
+  }
+
+  checked = true;
+  last_seconds = now;
+
+  return rang;
+}
@@ -0,0 +1,48 @@
+/*
+ * Alarms, kept sorted by time of day in the DS1307's NVRAM (see nvram.h).
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _ALARMS_H_
+#define _ALARMS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* **************************************** */
+
+#define ALARMS_MAX 8
+
+/* Bit (day - 1) of days is set if the alarm goes off on that day of
+   the week (DS1307 numbering, 1-7). */
+#define ALARM_EVERY_DAY 0x7F
+
+struct alarm_t {
+  uint8_t hours;
+  uint8_t minutes;
+  uint8_t days;
+};
+
+/* Read the table from NVRAM. A table that doesn't make sense is
+   taken to be empty. */
+void alarms_load(void);
+
+uint8_t alarms_count(void);
+bool alarm_get(uint8_t i, struct alarm_t *a);
+
+/* Add an alarm or remove the i'th one, keeping the table sorted, and
+   write it back to NVRAM. False if the table is full, the alarm is not
+   a time of day, or it couldn't be saved. */
+bool alarm_add(const struct alarm_t *a);
+bool alarm_remove(uint8_t i);
+
+/*
+ * Call periodically: true if an alarm has gone off since the last
+ * call. Uses the SRAM clock, and reads the DS1307 only to confirm an
+ * alarm that looks due, or when the clock is stale.
+ */
+bool alarms_check(void);
+
+#endif /* _ALARMS_H_ */
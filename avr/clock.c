@@ -0,0 +1,212 @@
+/*
+ * The time of day, kept in SRAM and checked against the DS1307 now
+ * and then.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "clock.h"
+#include "ds1307.h"
+#include "nvram.h"
+#include "timebase.h"
+#include "timers.h"
+
+/* **************************************** */
+
+#define RESYNC_MS (CLOCK_RESYNC_MINUTES * 60UL * 1000UL)
+
+static bool synced;
+static struct ds1307_time_t sync_time;  /* As read from the DS1307, */
+static uint32_t sync_ms;                /* at this timers_now(), */
+static uint8_t sync_epoch;              /* and timers_epoch(). */
+static bool sync_on_tick;
+
+/* Where the drift measurement runs from: a sync on a WDT tick. */
+static bool cal_started;
+static struct ds1307_time_t cal_time;
+static uint32_t cal_ms;
+static uint8_t cal_epoch;
+
+static struct clock_stats_t stats;
+
+/* stats.ppm came from NVRAM or a measurement. */
+static bool calibrated;
+
+/* Milliseconds since the last resync, corrected for drift. */
+static uint32_t
+clock_elapsed(uint32_t now)
+{
+  uint32_t raw = now - sync_ms;
+
+  if(timebase_current() == TIMEBASE_SQW) {
+    return raw;
+  }
+
+  return (int64_t)raw * 1000000 / (1000000 + stats.ppm);
+}
+
+static inline uint32_t
+time_of_day(const struct ds1307_time_t *t)
+{
+  return t->hours * 3600UL + t->minutes * 60UL + t->seconds;
+}
+
+/* Seconds from a to b by the DS1307, assuming less than a week. */
+static uint32_t
+seconds_between(const struct ds1307_time_t *a, const struct ds1307_time_t *b)
+{
+  uint8_t days = (b->day + 7 - a->day) % 7;
+
+  return days * CLOCK_SECONDS_PER_DAY + time_of_day(b) - time_of_day(a);
+}
+
+static void
+clock_save(void)
+{
+  uint8_t buf[NVRAM_CLOCK_LEN];
+
+  buf[0] = NVRAM_MAGIC;
+  memcpy(&buf[1], &stats.ppm, sizeof(stats.ppm));
+  ds1307_nvram_write(NVRAM_CLOCK, buf, sizeof(buf));
+}
+
+/* Compare what we reckoned had elapsed with what the DS1307 says. Only
+   on a WDT tick with the time base unchanged since the last sync. */
+static void
+clock_calibrate(const struct ds1307_time_t *t, uint32_t now)
+{
+  if(synced && sync_epoch == timers_epoch()) {
+    stats.error_ms = (int32_t)(clock_elapsed(now) - seconds_between(&sync_time, t) * 1000);
+  }
+
+  if(cal_started && cal_epoch == timers_epoch()) {
+    uint32_t rtc_s = seconds_between(&cal_time, t);
+    int32_t ppm;
+
+    /* Keep measuring from the same place. */
+    if(rtc_s < CLOCK_CALIBRATE_SECONDS) {
+      return;
+    }
+
+    ppm = ((int64_t)(now - cal_ms) - rtc_s * 1000LL) * 1000000 / (rtc_s * 1000LL);
+
+    if(ppm <= CLOCK_PPM_MAX && ppm >= -CLOCK_PPM_MAX) {
+      /* Smooth out the DS1307's one-second granularity. */
+      stats.ppm = calibrated ? (3 * stats.ppm + ppm) / 4 : ppm;
+      stats.calibrations++;
+      calibrated = true;
+
+      clock_save();
+    }
+  }
+
+  cal_time = *t;
+  cal_ms = now;
+  cal_epoch = timers_epoch();
+  cal_started = true;
+}
+
+/* **************************************** */
+
+bool
+clock_init(void)
+{
+  uint8_t buf[NVRAM_CLOCK_LEN];
+  int32_t ppm;
+
+  if(ds1307_nvram_read(NVRAM_CLOCK, buf, sizeof(buf)) && buf[0] == NVRAM_MAGIC) {
+    memcpy(&ppm, &buf[1], sizeof(ppm));
+    if(ppm <= CLOCK_PPM_MAX && ppm >= -CLOCK_PPM_MAX) {
+      stats.ppm = ppm;
+      calibrated = true;
+    }
+  }
+
+  return clock_sync(false);
+}
+
+bool
+clock_sync(bool on_tick)
+{
+  struct ds1307_time_t t;
+
+  uint32_t now;
+
+  if(!ds1307_read(&t)) {
+    return false;
+  }
+
+  now = timers_now();
+  if(on_tick && timebase_current() == TIMEBASE_WDT) {
+    clock_calibrate(&t, now);
+  } else {
+    cal_started = false;
+  }
+
+  sync_time = t;
+  sync_ms = now;
+  sync_epoch = timers_epoch();
+  sync_on_tick = on_tick;
+  synced = true;
+  stats.syncs++;
+
+  return true;
+}
+
+bool
+clock_stale(void)
+{
+  return !synced || !sync_on_tick || sync_epoch != timers_epoch()
+    || timers_now() - sync_ms >= RESYNC_MS;
+}
+
+bool
+clock_now(uint32_t *seconds, uint8_t *day)
+{
+  if(!synced) {
+    return false;
+  }
+
+  uint32_t s = time_of_day(&sync_time) + clock_elapsed(timers_now()) / 1000;
+  uint8_t days = s / CLOCK_SECONDS_PER_DAY;
+
+  *seconds = s % CLOCK_SECONDS_PER_DAY;
+  *day = (sync_time.day - 1 + days) % 7 + 1;
+
+  return true;
+}
+
+bool
+clock_get(struct ds1307_time_t *t)
+{
+  uint32_t s;
+
+  if(clock_stale()) {
+    clock_sync(false);
+  }
+
+  if(!clock_now(&s, &t->day)) {
+    return false;
+  }
+
+  t->hours = s / 3600;
+  t->minutes = (s / 60) % 60;
+  t->seconds = s % 60;
+  t->date = sync_time.date;
+  t->month = sync_time.month;
+  t->year = sync_time.year;
+  t->twelve_hour = sync_time.twelve_hour;
+
+  return true;
+}
+
+void
+clock_get_stats(struct clock_stats_t *s)
+{
+  *s = stats;
+}
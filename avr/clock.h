@@ -0,0 +1,82 @@
+/*
+ * The time of day, kept in SRAM and checked against the DS1307 now
+ * and then.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ds1307.h"
+
+/* **************************************** */
+
+/* Read the DS1307 at least this often. */
+#ifndef CLOCK_RESYNC_MINUTES
+#define CLOCK_RESYNC_MINUTES 60
+#endif
+
+/* Resyncs this far apart are long enough to measure drift over. The
+   DS1307 counts whole seconds, so shorter ones are mostly noise. */
+#ifndef CLOCK_CALIBRATE_SECONDS
+#define CLOCK_CALIBRATE_SECONDS 600
+#endif
+
+#define CLOCK_SECONDS_PER_DAY 86400UL
+
+/*
+ * Between reads of the DS1307 the time is extrapolated from
+ * timers_now(), so reading it costs no TWI traffic. Only the time of
+ * day and day of the week advance; the date is as at the last read.
+ *
+ * The WDT oscillator is off by a few percent and varies with
+ * temperature and supply, so resyncs compare the elapsed timers_now()
+ * with the DS1307's and fold the difference into a running correction
+ * in parts per million, kept in NVRAM.
+ *
+ * timers_now() is only exact at a time base interrupt, so a
+ * measurement runs between two resyncs made on a WDT tick, with the
+ * time base left alone in between (the same timers_epoch()). Any other
+ * resync, such as after setting the time, starts a fresh measurement,
+ * and marks the clock stale so the next tick reads the DS1307 again.
+ * The square wave comes from the DS1307's own crystal, so under it no
+ * correction is applied or measured.
+ */
+
+struct clock_stats_t {
+  int32_t ppm;          /* How fast timers_now() runs, corrected for. */
+  int32_t error_ms;     /* Corrected SRAM clock minus DS1307 at the last resync. */
+  uint16_t syncs;
+  uint16_t calibrations;
+};
+
+void clock_get_stats(struct clock_stats_t *stats);
+
+/* The largest believable drift correction, in ppm. */
+#define CLOCK_PPM_MAX 200000L
+
+/* Restore the drift correction from the DS1307's NVRAM, and read the
+   time. */
+bool clock_init(void);
+
+/* Read the DS1307 now. on_tick if we're handling a timer that the
+   time base interrupt has just fired, as check_alarm() is. */
+bool clock_sync(bool on_tick);
+
+/* Has it been CLOCK_RESYNC_MINUTES since the last read, or has that
+   read or the time base let us down since? */
+bool clock_stale(void);
+
+/* The time of day in seconds and the day of the week (1-7). Never
+   touches the DS1307. False if it has never been read. */
+bool clock_now(uint32_t *seconds, uint8_t *day);
+
+/* The full time, reading the DS1307 first if the clock is stale. */
+bool clock_get(struct ds1307_time_t *t);
+
+#endif /* _CLOCK_H_ */
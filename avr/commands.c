@@ -6,8 +6,17 @@
  */
 
 #include "sp0256.h"
+#include "alarms.h"
+#include "clock.h"
 #include "ds1307.h"
+#include "events.h"
+#include "frame.h"
+#include "gesture.h"
 #include "mma7660fc.h"
+#include "static_assert.h"
+#include "temp.h"
+#include "timebase.h"
+#include "timers.h"
 #include "uart.h"
 
 #include "commands.h"
@@ -25,6 +34,8 @@ speak_the_time(void)
 {
   struct ds1307_time_t t;
 
+  /* Straight from the DS1307: someone is listening, and the SRAM
+     clock is only good to a second or so. */
   if(ds1307_read(&t)) {
     uart_putstringP(PSTR("The time is "), false);
     uart_putw_dec(t.hours);
@@ -79,38 +90,77 @@ speak_acc_reading(void)
 
 /* FIXME quick hack */
 static bool
-speak_acc_orientation(void)
+speak_acc_orientation(uint8_t tilt)
 {
   static mma7660fc_tilt_orientation_t o_old;
-  mma7660fc_tilt_orientation_t o;
-  mma7660fc_tilt_back_front_t bf;
-
-  if(mma7660fc_read_tilt(&o, &bf)) {
-    if(o != o_old) {
-      switch(o) {
-      case MMA7660FC_tilt_left:
-        uart_debug_putstringP(PSTR("** acc left"));
-        speak_P(left);
-        break;
-      case MMA7660FC_tilt_right:
-        uart_debug_putstringP(PSTR("** acc right"));
-        speak_P(right);
-        break;
-      case MMA7660FC_tilt_down:
-        uart_debug_putstringP(PSTR("** acc down"));
-        speak_P(down);
-        break;
-      case MMA7660FC_tilt_up:
-        uart_debug_putstringP(PSTR("** acc up"));
-        speak_P(up);
-        break;
-      }
+  mma7660fc_tilt_orientation_t o = mma7660fc_tilt_orientation(tilt);
 
-      o_old = o;
+  if(o != o_old) {
+    switch(o) {
+    case MMA7660FC_tilt_left:
+      uart_debug_putstringP(PSTR("** acc left"));
+      speak_P(left);
+      break;
+    case MMA7660FC_tilt_right:
+      uart_debug_putstringP(PSTR("** acc right"));
+      speak_P(right);
+      break;
+    case MMA7660FC_tilt_down:
+      uart_debug_putstringP(PSTR("** acc down"));
+      speak_P(down);
+      break;
+    case MMA7660FC_tilt_up:
+      uart_debug_putstringP(PSTR("** acc up"));
+      speak_P(up);
+      break;
+    }
 
-      return true;
-    } else {
-      uart_debug_putstringP(PSTR("** orientation hasn't changed"));
+    o_old = o;
+
+    return true;
+  } else {
+    uart_debug_putstringP(PSTR("** orientation hasn't changed"));
+  }
+
+  return false;
+}
+
+/* XOUT through PD. */
+#define ACC_REGS (MMA7660FC_PD_REG + 1)
+
+static void
+print_acc_registers(const uint8_t regs[ACC_REGS])
+{
+  for(uint8_t i = 0; i < ACC_REGS; i++) {
+    uart_putw_dec(regs[i]);
+    uart_tx_nl();
+  }
+}
+
+static void
+dump_acc_registers(void)
+{
+  uint8_t regs[ACC_REGS];
+
+  if(mma7660fc_read_regs(MMA7660FC_XOUT_REG, regs, ACC_REGS)) {
+    print_acc_registers(regs);
+  }
+}
+
+/* **************************************** */
+
+void
+handle_accelerometer_event(void)
+{
+  uint8_t regs[ACC_REGS];
+
+  uart_debug_putstringP(PSTR("handle_accelerometer_event()"));
+
+  /* One burst gets us both the debugging dump and the tilt status. */
+  if(mma7660fc_read_regs(MMA7660FC_XOUT_REG, regs, ACC_REGS)) {
+    print_acc_registers(regs);
+    if(speak_acc_orientation(regs[MMA7660FC_TILT_REG])) {
+      speak_the_time();
     }
   } else {
     uart_putstringP(PSTR("*** Acc read failed."), true);
@@ -118,72 +168,838 @@ speak_acc_orientation(void)
     speak_P(clown);
   }
 
-  return false;
+  uart_debug_putstringP(PSTR("handle_accelerometer_event() finished"));
+}
+
+/* **************************************** */
+/* Gestures. */
+
+void
+handle_shake_event(void)
+{
+  uart_debug_putstringP(PSTR("handle_shake_event()"));
+
+  speak_the_time();
+}
+
+void
+handle_double_tap_event(void)
+{
+  uart_debug_putstringP(PSTR("handle_double_tap_event()"));
+
+  speak_acc_reading();
+}
+
+/* Face down means be quiet. */
+void
+handle_face_down_event(void)
+{
+  uart_debug_putstringP(PSTR("handle_face_down_event()"));
+
+  sp0256_cancel();
+}
+
+/* **************************************** */
+/* Temperatures, once temp_start() has readings. */
+
+void
+handle_temperature_event(void)
+{
+  uint8_t n = temp_count();
+
+  uart_debug_putstringP(PSTR("handle_temperature_event()"));
+
+  for(uint8_t i = 0; i < n; i++) {
+    int16_t t;
+
+    /* Say which, if there's a choice. */
+    if(n > 1) {
+      speak_P(sensors);
+      speak_number(i + 1);
+    }
+
+    uart_putstringP(PSTR("temperature "), false);
+    uart_putw_dec(i);
+    uart_tx(' ');
+
+    if(temp_get(i, &t)) {
+      bool negative = t < 0;
+      uint16_t d = negative ? -t : t;
+
+      if(negative) {
+        uart_tx('-');
+      }
+      uart_putw_dec(d / 10);
+      uart_tx('.');
+      uart_putw_dec(d % 10);
+      uart_tx_nl();
+
+      speak_P(it);
+      speak_P(is);
+      if(negative) {
+        speak_P(minus);
+      }
+      speak_number(d / 10);
+      if(d % 10) {
+        speak_P(point);
+        speak_number(d % 10);
+      }
+      speak_P(degrees);
+    } else {
+      uart_putstringP(PSTR("*** read failed."), true);
+      speak_P(clown);
+    }
+  }
+}
+
+/* **************************************** */
+
+static void
+print_uart_stats(void)
+{
+  struct uart_stats_t stats;
+
+  uart_get_stats(&stats);
+
+  uart_putstringP(PSTR("rx dropped "), false);
+  uart_putw_dec(stats.rx_dropped);
+  uart_tx_nl();
+  uart_putstringP(PSTR("rx overrun "), false);
+  uart_putw_dec(stats.rx_overrun);
+  uart_tx_nl();
+  uart_putstringP(PSTR("rx framing "), false);
+  uart_putw_dec(stats.rx_framing);
+  uart_tx_nl();
 }
 
 static void
-dump_acc_registers(void)
+print_event_stats(void)
 {
-  uint8_t twsr;
-  uint8_t t;
+  static const char names[EVENT_TYPES][6] PROGMEM = {
+    [EVENT_TIMER] = "timer",
+    [EVENT_ACCELEROMETER] = "accel",
+    [EVENT_UART] = "uart",
+  };
+  struct events_stats_t stats;
 
-  TWI_start(MMA7660FC_ADDR, &twsr, WRITE);
-  TWI_write(&twsr, 0x0);
-  TWI_rep_start(MMA7660FC_ADDR, &twsr, READ);
+  for(uint8_t t = 0; t < EVENT_TYPES; t++) {
+    events_get_stats(t, &stats);
 
-  for(uint8_t i = 0; i <= 0x0A; i++) {
-    TWI_read(&twsr, &t, true);
-    uart_putw_dec(t);
+    uart_putstringP(PSTR("events "), false);
+    uart_putstringP(names[t], false);
+    uart_tx(' ');
+    uart_putw_dec(stats.occurred);
+    uart_putstringP(PSTR(" coalesced "), false);
+    uart_putw_dec(stats.coalesced);
+    uart_putstringP(PSTR(" latency max ms "), false);
+    uart_putl_dec(stats.latency_max);
     uart_tx_nl();
   }
+}
+
+static void
+print_clock_stats(void)
+{
+  struct clock_stats_t stats;
+
+  clock_get_stats(&stats);
+
+  uart_putstringP(PSTR("clock drift ppm "), false);
+  uart_putsl_dec(stats.ppm);
+  uart_putstringP(PSTR(" last error ms "), false);
+  uart_putsl_dec(stats.error_ms);
+  uart_putstringP(PSTR(" syncs "), false);
+  uart_putw_dec(stats.syncs);
+  uart_putstringP(PSTR(" calibrations "), false);
+  uart_putw_dec(stats.calibrations);
+  uart_tx_nl();
+}
 
-  TWI_read(&twsr, &t, false);
-  TWI_send_stop(&twsr);
+static void
+print_twi_stats(void)
+{
+  struct TWI_stats_t stats;
+
+  for(uint8_t i = 0; TWI_get_stats(i, &stats); i++) {
+    uart_putstringP(PSTR("twi "), false);
+    uart_putw_dec(stats.addr);
+    uart_putstringP(PSTR(" txns "), false);
+    uart_putw_dec(stats.transactions);
+    uart_putstringP(PSTR(" errors "), false);
+    uart_putw_dec(stats.errors);
+    uart_putstringP(PSTR(" timeouts "), false);
+    uart_putw_dec(stats.timeouts);
+    uart_putstringP(PSTR(" retries "), false);
+    uart_putw_dec(stats.retries);
+    uart_putstringP(PSTR(" latency "), false);
+    uart_putw_dec(stats.latency_last);
+    uart_putstringP(PSTR(" max "), false);
+    uart_putw_dec(stats.latency_max);
+    uart_tx_nl();
+  }
+}
+
+/* Stop capturing accelerometer samples (and classifying them, if
+   that's what they were for) and print them out, one per line: x y z
+   tilt. */
+static void
+dump_acc_trace(void)
+{
+  struct mma7660fc_sample_t sample;
+
+  gesture_stop();
+
+  while(mma7660fc_capture_read(&sample)) {
+    uart_putsw_dec(sample.x);
+    uart_tx(' ');
+    uart_putsw_dec(sample.y);
+    uart_tx(' ');
+    uart_putsw_dec(sample.z);
+    uart_tx(' ');
+    uart_putw_dec(sample.tilt);
+    uart_tx_nl();
+  }
+
+  uart_putstringP(PSTR("dropped "), false);
+  uart_putw_dec(mma7660fc_capture_dropped());
+  uart_tx_nl();
+
+  mma7660fc_init_Bryan();
 }
 
 /* **************************************** */
+/* Command language.
 
-void
-handle_accelerometer_event(void)
+   A command is a keyword followed by arguments, which are either
+   decimal numbers or keywords, separated by spaces and terminated by
+   CR or LF:
+
+     stats
+     read-sensors
+     temperature [search]               (reported when it's ready)
+     temperature precision N            (ten-thousandths of a degree)
+     set-time HOURS MINUTES SECONDS [DAY DATE MONTH YEAR]
+     set-alarm HOURS MINUTES [DAYS]     (days bitmask, default every day)
+     clear-alarm N
+     alarms
+     speak-allophones A A ...           (up to CMD_MAX_ARGS)
+     speak-number N
+     timebase wdt|sqw
+     capture | trace | gestures
+
+   Parsing is a single pass over the characters. Keywords are matched
+   against the table in program memory as they arrive by keeping a
+   mask of those that still match, so no word is ever buffered. Each
+   argument is tagged as a number or a keyword, and the command checks
+   the lot before doing anything. */
+
+typedef enum {
+  KW_STATS,
+  KW_READ_SENSORS,
+  KW_TEMPERATURE,
+  KW_SET_TIME,
+  KW_SET_ALARM,
+  KW_CLEAR_ALARM,
+  KW_ALARMS,
+  KW_SPEAK_ALLOPHONES,
+  KW_SPEAK_NUMBER,
+  KW_TIMEBASE,
+  KW_CAPTURE,
+  KW_TRACE,
+  KW_GESTURES,
+  KW_WDT,
+  KW_SQW,
+  KW_SEARCH,
+  KW_PRECISION,
+  KEYWORDS,
+  KW_NONE = KEYWORDS
+} keyword_t;
+
+static const char kw_stats[] PROGMEM = "stats";
+static const char kw_read_sensors[] PROGMEM = "read-sensors";
+static const char kw_temperature[] PROGMEM = "temperature";
+static const char kw_set_time[] PROGMEM = "set-time";
+static const char kw_set_alarm[] PROGMEM = "set-alarm";
+static const char kw_clear_alarm[] PROGMEM = "clear-alarm";
+static const char kw_alarms[] PROGMEM = "alarms";
+static const char kw_speak_allophones[] PROGMEM = "speak-allophones";
+static const char kw_speak_number[] PROGMEM = "speak-number";
+static const char kw_timebase[] PROGMEM = "timebase";
+static const char kw_capture[] PROGMEM = "capture";
+static const char kw_trace[] PROGMEM = "trace";
+static const char kw_gestures[] PROGMEM = "gestures";
+static const char kw_wdt[] PROGMEM = "wdt";
+static const char kw_sqw[] PROGMEM = "sqw";
+static const char kw_search[] PROGMEM = "search";
+static const char kw_precision[] PROGMEM = "precision";
+
+static PGM_P const keywords[KEYWORDS] PROGMEM = {
+  kw_stats,
+  kw_read_sensors,
+  kw_temperature,
+  kw_set_time,
+  kw_set_alarm,
+  kw_clear_alarm,
+  kw_alarms,
+  kw_speak_allophones,
+  kw_speak_number,
+  kw_timebase,
+  kw_capture,
+  kw_trace,
+  kw_gestures,
+  kw_wdt,
+  kw_sqw,
+  kw_search,
+  kw_precision
+};
+
+/* The match mask is 32 bits. */
+STATIC_ASSERT(KEYWORDS <= 32);
+
+#define KW_BIT(k) (1UL << (k))
+#define ALL_KEYWORDS (UINT32_MAX >> (32 - KEYWORDS))
+
+#define CMD_MAX_ARGS 16
+
+#if CMD_MAX_ARGS > 16
+#error "The keyword argument mask has room for 16 arguments"
+#endif
+
+typedef enum {
+  P_SPACE,      /* Between words. */
+  P_WORD,       /* In a keyword. */
+  P_NUMBER,     /* In a number. */
+  P_ERROR       /* Skip to the end of the line. */
+} parse_state_t;
+
+static struct {
+  parse_state_t state;
+  uint8_t pos;                  /* In the current keyword. */
+  uint32_t match;               /* Keywords still matching it. */
+  uint16_t number;
+  keyword_t cmd;
+  uint8_t nargs;
+  uint16_t args[CMD_MAX_ARGS];  /* Numbers, or keyword_t, */
+  uint16_t keywords;            /* as given by bit i for args[i]. */
+} parser = { .state = P_SPACE, .cmd = KW_NONE };
+
+static void
+parse_reset(void)
 {
-  uart_debug_putstringP(PSTR("handle_accelerometer_event()"));
+  parser.state = P_SPACE;
+  parser.cmd = KW_NONE;
+  parser.nargs = 0;
+  parser.keywords = 0;
+}
 
-  // FIXME probably not necessary
-  // mma7660fc_clear_interrupt();
+/* Knock out the keywords that don't have c at this position. */
+static void
+parse_word_char(char c)
+{
+  for(uint8_t k = 0; k < KEYWORDS; k++) {
+    if(parser.match & KW_BIT(k)) {
+      PGM_P kw = (PGM_P)pgm_read_word(&keywords[k]);
+      char kc = pgm_read_byte(kw + parser.pos);
 
-  /* FIXME debugging */
-  sp0256_turn_on();
-  dump_acc_registers();
-  if(speak_acc_orientation()) {
-    speak_the_time();
+      /* A '\0' in the input mustn't take us past the end of kw. */
+      if(kc == '\0' || kc != c) {
+        parser.match &= ~KW_BIT(k);
+      }
+    }
   }
-  sp0256_turn_off();
+  parser.pos++;
+}
 
-  uart_debug_putstringP(PSTR("handle_accelerometer_event() finished"));
+/* The keyword that matched exactly, if any. */
+static keyword_t
+parse_word_end(void)
+{
+  for(uint8_t k = 0; k < KEYWORDS; k++) {
+    if(parser.match & KW_BIT(k)) {
+      PGM_P kw = (PGM_P)pgm_read_word(&keywords[k]);
+
+      if(pgm_read_byte(kw + parser.pos) == '\0') {
+        return k;
+      }
+    }
+  }
+
+  return KW_NONE;
+}
+
+static bool
+parse_arg(uint16_t arg, bool keyword)
+{
+  if(parser.nargs == CMD_MAX_ARGS) {
+    return false;
+  }
+  if(keyword) {
+    parser.keywords |= 1U << parser.nargs;
+  }
+  parser.args[parser.nargs++] = arg;
+
+  return true;
+}
+
+static void
+parse_token_end(void)
+{
+  if(parser.state == P_WORD) {
+    keyword_t k = parse_word_end();
+
+    if(k == KW_NONE) {
+      parser.state = P_ERROR;
+    } else if(parser.cmd == KW_NONE) {
+      parser.cmd = k;
+    } else if(!parse_arg(k, true)) {
+      parser.state = P_ERROR;
+    }
+  } else if(parser.state == P_NUMBER) {
+    if(parser.cmd == KW_NONE || !parse_arg(parser.number, false)) {
+      parser.state = P_ERROR;
+    }
+  }
+
+  if(parser.state != P_ERROR) {
+    parser.state = P_SPACE;
+  }
+}
+
+static void execute_command(keyword_t cmd, uint8_t nargs, const uint16_t *args, uint16_t keywords);
+
+static void
+parse_char(char c)
+{
+  if(c == '\r' || c == '\n') {
+    parse_token_end();
+    if(parser.state == P_ERROR) {
+      uart_putstringP(PSTR("*** Bad command."), true);
+    } else if(parser.cmd != KW_NONE) {
+      execute_command(parser.cmd, parser.nargs, parser.args, parser.keywords);
+    }
+    parse_reset();
+    return;
+  }
+
+  switch(parser.state) {
+  case P_SPACE:
+    if(c == ' ' || c == '\t') {
+      break;
+    } else if(c >= '0' && c <= '9') {
+      parser.state = P_NUMBER;
+      parser.number = c - '0';
+    } else {
+      parser.state = P_WORD;
+      parser.pos = 0;
+      parser.match = ALL_KEYWORDS;
+      parse_word_char(c);
+    }
+    break;
+
+  case P_WORD:
+    if(c == ' ' || c == '\t') {
+      parse_token_end();
+    } else {
+      parse_word_char(c);
+    }
+    break;
+
+  case P_NUMBER:
+    if(c == ' ' || c == '\t') {
+      parse_token_end();
+    } else if(c >= '0' && c <= '9'
+              && parser.number <= (UINT16_MAX - (c - '0')) / 10) {
+      parser.number = parser.number * 10 + (c - '0');
+    } else {
+      parser.state = P_ERROR;
+    }
+    break;
+
+  case P_ERROR:
+    break;
+  }
 }
 
 /* **************************************** */
 
+/* Argument i is the keyword k. */
+static inline bool
+arg_is(uint8_t i, keyword_t k, uint8_t nargs, const uint16_t *args, uint16_t keywords)
+{
+  return i < nargs && (keywords & (1U << i)) && args[i] == k;
+}
+
+/* Arguments from i on are all numbers. */
+static inline bool
+args_numbers(uint8_t i, uint16_t keywords)
+{
+  return (keywords >> i) == 0;
+}
+
+/* Check them all before the SP0256 hears any. */
+static bool
+cmd_speak_allophones(uint8_t nargs, const uint16_t *args)
+{
+  if(nargs == 0) {
+    return false;
+  }
+
+  for(uint8_t i = 0; i < nargs; i++) {
+    if(args[i] > 63) {
+      return false;
+    }
+  }
+
+  for(uint8_t i = 0; i < nargs; i++) {
+    speak_allophone(args[i]);
+  }
+
+  return true;
+}
+
+static bool
+cmd_set_time(uint8_t nargs, const uint16_t *args)
+{
+  struct ds1307_time_t t;
+
+  if(nargs != 3 && nargs != 7) {
+    return false;
+  }
+
+  /* Keep the date and 12/24h mode unless we're told otherwise. */
+  if(!ds1307_read(&t)) {
+    return false;
+  }
+
+  t.hours = args[0];
+  t.minutes = args[1];
+  t.seconds = args[2];
+  if(nargs == 7) {
+    t.day = args[3];
+    t.date = args[4];
+    t.month = args[5];
+    t.year = args[6];
+  }
+
+  /* ds1307_write() checks the ranges, but only in bytes. */
+  for(uint8_t i = 0; i < nargs; i++) {
+    if(args[i] > UINT8_MAX) {
+      return false;
+    }
+  }
+
+  return ds1307_write(&t) && clock_sync(false);
+}
+
+static bool
+cmd_set_alarm(uint8_t nargs, const uint16_t *args)
+{
+  struct alarm_t a;
+
+  if(nargs != 2 && nargs != 3) {
+    return false;
+  }
+
+  a.hours = args[0];
+  a.minutes = args[1];
+  a.days = nargs == 3 ? args[2] : ALARM_EVERY_DAY;
+
+  return args[0] <= UINT8_MAX && args[1] <= UINT8_MAX
+    && (nargs == 2 || args[2] <= UINT8_MAX)
+    && alarm_add(&a);
+}
+
 static void
-process_command(char *cmd)
+print_alarms(void)
 {
-  // FIXME
+  struct alarm_t a;
+
+  for(uint8_t i = 0; alarm_get(i, &a); i++) {
+    uart_putw_dec(i);
+    uart_tx(' ');
+    uart_putw_dec(a.hours);
+    uart_tx(' ');
+    uart_putw_dec(a.minutes);
+    uart_tx(' ');
+    uart_putw_dec(a.days);
+    uart_tx_nl();
+  }
+}
+
+static void
+read_sensors(void)
+{
+  struct ds1307_time_t t;
+
+  if(clock_get(&t)) {
+    uart_putstringP(PSTR("time "), false);
+    uart_putw_dec(t.hours);
+    uart_tx(' ');
+    uart_putw_dec(t.minutes);
+    uart_tx(' ');
+    uart_putw_dec(t.seconds);
+    uart_tx_nl();
+  }
+
+  dump_acc_registers();
+}
+
+static void
+execute_command(keyword_t cmd, uint8_t nargs, const uint16_t *args, uint16_t keywords)
+{
+  bool ok = true;
+
+  switch(cmd) {
+  case KW_STATS:
+    if((ok = nargs == 0)) {
+      print_uart_stats();
+      print_twi_stats();
+      print_clock_stats();
+      print_event_stats();
+    }
+    break;
+  case KW_READ_SENSORS:
+    if((ok = nargs == 0)) {
+      read_sensors();
+    }
+    break;
+  case KW_TEMPERATURE:
+    if(nargs == 0) {
+      ok = temp_start();
+    } else if(nargs == 1 && arg_is(0, KW_SEARCH, nargs, args, keywords)) {
+      ok = temp_search();
+      uart_putstringP(PSTR("sensors "), false);
+      uart_putw_dec(temp_count());
+      uart_tx_nl();
+    } else if(nargs == 2 && arg_is(0, KW_PRECISION, nargs, args, keywords)
+              && args_numbers(1, keywords)) {
+      ok = temp_set_precision(args[1]);
+    } else {
+      ok = false;
+    }
+    break;
+  case KW_SET_TIME:
+    ok = args_numbers(0, keywords) && cmd_set_time(nargs, args);
+    break;
+  case KW_SET_ALARM:
+    ok = args_numbers(0, keywords) && cmd_set_alarm(nargs, args);
+    break;
+  case KW_CLEAR_ALARM:
+    ok = nargs == 1 && args_numbers(0, keywords)
+      && args[0] <= UINT8_MAX && alarm_remove(args[0]);
+    break;
+  case KW_ALARMS:
+    if((ok = nargs == 0)) {
+      print_alarms();
+    }
+    break;
+  case KW_SPEAK_ALLOPHONES:
+    ok = args_numbers(0, keywords) && cmd_speak_allophones(nargs, args);
+    break;
+  case KW_SPEAK_NUMBER:
+    if((ok = nargs == 1 && args_numbers(0, keywords))) {
+      speak_number(args[0]);
+    }
+    break;
+  case KW_TIMEBASE:
+    if(nargs == 1 && arg_is(0, KW_SQW, nargs, args, keywords)) {
+      if(!timebase_select(TIMEBASE_SQW)) {
+        uart_putstringP(PSTR("*** No square wave."), true);
+      }
+    } else if(nargs == 1 && arg_is(0, KW_WDT, nargs, args, keywords)) {
+      timebase_select(TIMEBASE_WDT);
+    } else {
+      ok = false;
+    }
+    break;
+  case KW_CAPTURE:
+    if((ok = nargs == 0)) {
+      mma7660fc_capture_start();
+    }
+    break;
+  case KW_TRACE:
+    if((ok = nargs == 0)) {
+      dump_acc_trace();
+    }
+    break;
+  case KW_GESTURES:
+    if((ok = nargs == 0)) {
+      gesture_start();
+    }
+    break;
+  default:
+    ok = false;
+    break;
+  }
+
+  uart_putstringP(ok ? PSTR("ok") : PSTR("*** Failed."), true);
 }
 
 /* **************************************** */
-/* Buffer commands coming in on the serial port. FIXME is this more or
-   less efficient that giving each character to a state machine? */
+/* Binary frames, for scripts. See ../include/frame.h. */
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+void
+frame_execute(uint8_t opcode, const uint8_t *payload, uint8_t len)
+{
+  frame_status_t status = FRAME_OK;
+  uint8_t reply[FRAME_MAX_PAYLOAD - 1];
+  uint8_t rlen = 0;
+
+  switch(opcode) {
+  case FRAME_PING:
+    rlen = len < sizeof(reply) ? len : sizeof(reply);
+    for(uint8_t i = 0; i < rlen; i++) {
+      reply[i] = payload[i];
+    }
+    break;
+
+  case FRAME_GET_TIME: {
+    struct ds1307_time_t t;
+    struct frame_time_t *f = (struct frame_time_t *)reply;
+
+    if(len != 0) {
+      status = FRAME_BAD_REQUEST;
+    } else if(!clock_get(&t)) {
+      status = FRAME_FAILED;
+    } else {
+      f->hours = t.hours;
+      f->minutes = t.minutes;
+      f->seconds = t.seconds;
+      f->day = t.day;
+      f->date = t.date;
+      f->month = t.month;
+      f->year = t.year;
+      f->twelve_hour = t.twelve_hour;
+      rlen = sizeof(*f);
+    }
+    break;
+  }
+
+  case FRAME_SET_TIME: {
+    const struct frame_time_t *f = (const struct frame_time_t *)payload;
+    struct ds1307_time_t t;
+
+    if(len != sizeof(*f)) {
+      status = FRAME_BAD_REQUEST;
+      break;
+    }
+
+    t.hours = f->hours;
+    t.minutes = f->minutes;
+    t.seconds = f->seconds;
+    t.day = f->day;
+    t.date = f->date;
+    t.month = f->month;
+    t.year = f->year;
+    t.twelve_hour = f->twelve_hour;
+
+    if(!ds1307_write(&t) || !clock_sync(false)) {
+      status = FRAME_FAILED;
+    }
+    break;
+  }
+
+  case FRAME_GET_ALARMS: {
+    struct alarm_t a;
+
+    for(uint8_t i = 0; rlen + sizeof(struct frame_alarm_t) <= sizeof(reply) && alarm_get(i, &a); i++) {
+      reply[rlen++] = a.hours;
+      reply[rlen++] = a.minutes;
+      reply[rlen++] = a.days;
+    }
+    break;
+  }
+
+  case FRAME_SET_ALARM: {
+    struct alarm_t a;
+
+    if(len != sizeof(struct frame_alarm_t)) {
+      status = FRAME_BAD_REQUEST;
+      break;
+    }
+
+    a.hours = payload[0];
+    a.minutes = payload[1];
+    a.days = payload[2];
+    if(!alarm_add(&a)) {
+      status = FRAME_FAILED;
+    }
+    break;
+  }
+
+  case FRAME_CLEAR_ALARM:
+    if(len != 1) {
+      status = FRAME_BAD_REQUEST;
+    } else if(!alarm_remove(payload[0])) {
+      status = FRAME_FAILED;
+    }
+    break;
 
-#define COMMAND_BUFFER_SIZE 80
+  case FRAME_GET_STATS: {
+    struct frame_stats_t *f = (struct frame_stats_t *)reply;
+    struct uart_stats_t us;
+    struct clock_stats_t cs;
 
-static char command_buffer[COMMAND_BUFFER_SIZE];
-static uint8_t command_buffer_index = 0;
+    uart_get_stats(&us);
+    clock_get_stats(&cs);
+
+    put16(f->rx_dropped, us.rx_dropped);
+    put16(f->rx_overrun, us.rx_overrun);
+    put16(f->rx_framing, us.rx_framing);
+    put32(f->clock_ppm, cs.ppm);
+    put32(f->clock_error_ms, cs.error_ms);
+    put16(f->clock_syncs, cs.syncs);
+    rlen = sizeof(*f);
+    break;
+  }
+
+  case FRAME_SPEAK:
+    for(uint8_t i = 0; i < len; i++) {
+      if(payload[i] > 63) {
+        status = FRAME_BAD_REQUEST;
+        break;
+      }
+    }
+    if(status == FRAME_OK) {
+      for(uint8_t i = 0; i < len; i++) {
+        speak_allophone(payload[i]);
+      }
+    }
+    break;
+
+  default:
+    status = FRAME_BAD_REQUEST;
+    break;
+  }
+
+  frame_reply(opcode, status, reply, rlen);
+}
+
+/* **************************************** */
+/* Characters go straight from the RX FIFO to the parser, which keeps
+   all the state it needs between them. A FRAME_SOF outside a frame
+   starts a binary frame instead. */
 
 void
 handle_uart_reset(void)
 {
   uart_debug_putstringP(PSTR("handle_uart_reset()"));
-  command_buffer_index = 0;
+  parse_reset();
+  frame_reset();
 }
 
 void
@@ -193,40 +1009,30 @@ handle_uart_event(void)
 
   uart_debug_putstringP(PSTR("handle_uart_event()"));
 
-  /* Wait for a character to be received. */
-  while(!uart_rx(&c))
-    ;
-
-  /* Treat each of the buffered characters. */
-  do {
-    command_buffer[command_buffer_index] = c;
-    command_buffer_index++;
-
-    uart_debug_putstringP(PSTR("handle_uart_event(): got character"));
-
-    // FIXME newline, allow room for a \0
-    if(c == 0x0A || c == 0x0D || command_buffer_index == COMMAND_BUFFER_SIZE - 1) {
-      uart_debug_putstringP(PSTR("handle_uart_event(): processing command"));
-      command_buffer[command_buffer_index] = '\0';
-      uart_putstring(command_buffer, true);
-
-      for(int i = 0; i < command_buffer_index; i++) {
-        uart_tx(command_buffer[i]);
+  /* Treat each of the buffered characters. There may be none: the
+     event might be for the edge that woke us, or already handled. */
+  while(uart_rx(&c)) {
+    if(frame_active() || c == FRAME_SOF) {
+      /* A frame abandons any half-typed command. */
+      if(!frame_active()) {
+        parse_reset();
       }
-      uart_tx_nl();
+      frame_rx(c);
+      continue;
+    }
 
-      process_command(command_buffer);
+    /* Echo. */
+    if(c == '\r' || c == '\n') {
+      uart_tx_nl();
+    } else {
+      uart_tx(c);
+    }
 
-      command_buffer_index = 0;
+    parse_char(c);
+  }
 
-      /* FIXME debugging */
-      sp0256_turn_on();
-      // speak_acc_reading();
-      dump_acc_registers();
-      speak_the_time();
-      sp0256_turn_off();
-    }
-  } while(uart_rx(&c));
+  /* From the last character read, as well as the last edge on the pin. */
+  timer_start(TIMER_UART_IDLE, TIMER_UART_IDLE_MS, 0, NULL);
 
   uart_debug_putstringP(PSTR("handle_uart_event() finished"));
 }
@@ -32,9 +32,17 @@
 #ifndef _COMMANDS_H_
 #define _COMMANDS_H_
 
+void speak_the_time(void);
+
 void handle_accelerometer_event(void);
 
 void handle_uart_reset(void);
 void handle_uart_event(void);
 
+void handle_shake_event(void);
+void handle_double_tap_event(void);
+void handle_face_down_event(void);
+
+void handle_temperature_event(void);
+
 #endif /* _COMMANDS_H_ */
@@ -7,6 +7,14 @@ extern "C" {
 
 #include <stdint.h>
 
+/* Implementation, chosen at build time:
+    0: bit at a time, no table (smallest, slowest)
+   16: a nibble at a time, 16 byte table in flash
+  256: a byte at a time, 256 byte table in flash (fastest) */
+#ifndef CRC8_TABLE
+#define CRC8_TABLE 16
+#endif
+
 uint8_t crc8( uint8_t* data, uint16_t number_of_bytes_in_data );
 
 #ifdef __cplusplus
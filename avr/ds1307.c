@@ -0,0 +1,184 @@
+/*
+ * DS1307 RTC driver for an ATMEGA328 (really any AVR with TWI hardware).
+ *
+ * (C)opyright 2010, 2011 Peter Gammie, peteg42 at gmail dot com. All rights reserved.
+ * Commenced September 2010.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "ds1307.h"
+#include "TWI.h"
+
+/* **************************************** */
+
+static const uint8_t days_in_month[12] PROGMEM = {
+  31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+/* **************************************** */
+
+bool
+ds1307_read(struct ds1307_time_t *time_data)
+{
+  uint8_t regs[7];
+
+  /* Read the seven time registers starting at address 0. */
+  if(!TWI_read_regs(DS1307_ADDR, 0x0, regs, sizeof(regs))) {
+    return false;
+  }
+
+  time_data->seconds = fromBCD(regs[0] & ~_BV(CLOCK_HALT));
+  time_data->minutes = fromBCD(regs[1]);
+
+  /* The hours register. 12AM is midnight, 12PM noon. */
+  time_data->twelve_hour = regs[2] & TWELVE_HOUR;
+  if(time_data->twelve_hour) {
+    uint8_t hours = fromBCD(regs[2] & 0x1F) % 12;
+    if(regs[2] & AMPM) {
+      hours += 12;
+    }
+    time_data->hours = hours;
+  } else {
+    time_data->hours = fromBCD(regs[2] & 0x3F);
+  }
+
+  time_data->day = fromBCD(regs[3]);
+  time_data->date = fromBCD(regs[4]);
+  time_data->month = fromBCD(regs[5]);
+  time_data->year = fromBCD(regs[6]);
+
+  return true;
+}
+
+bool
+ds1307_valid(const struct ds1307_time_t *t)
+{
+  uint8_t days;
+
+  if(t->seconds > 59 || t->minutes > 59 || t->hours > 23
+     || t->day < 1 || t->day > 7
+     || t->month < 1 || t->month > 12 || t->year > 99) {
+    return false;
+  }
+
+  days = pgm_read_byte(&days_in_month[t->month - 1]);
+  if(t->month == 2 && t->year % 4 == 0) {
+    days++;
+  }
+
+  return t->date >= 1 && t->date <= days;
+}
+
+bool
+ds1307_write(const struct ds1307_time_t *time_data)
+{
+  uint8_t regs[7];
+
+  if(!ds1307_valid(time_data)) {
+    return false;
+  }
+
+  /* Keep the oscillator running. */
+  regs[0] = toBCD(time_data->seconds) & ~_BV(CLOCK_HALT);
+  regs[1] = toBCD(time_data->minutes);
+  if(time_data->twelve_hour) {
+    uint8_t hours = time_data->hours % 12;
+    regs[2] = TWELVE_HOUR | toBCD(hours == 0 ? 12 : hours)
+      | (time_data->hours >= 12 ? AMPM : 0);
+  } else {
+    regs[2] = toBCD(time_data->hours);
+  }
+  regs[3] = toBCD(time_data->day);
+  regs[4] = toBCD(time_data->date);
+  regs[5] = toBCD(time_data->month);
+  regs[6] = toBCD(time_data->year);
+
+  /* Start writing at address 0. */
+  return TWI_write_regs(DS1307_ADDR, 0x0, regs, sizeof(regs));
+}
+
+/* **************************************** */
+
+/* The register pointer wraps from the end of the NVRAM back to the
+   clock, so don't let a burst run off the end. */
+static inline bool
+nvram_fits(uint8_t offset, uint8_t len)
+{
+  return offset < DS1307_NVRAM_LEN && len <= DS1307_NVRAM_LEN - offset;
+}
+
+bool
+ds1307_nvram_read(uint8_t offset, uint8_t *buf, uint8_t len)
+{
+  return nvram_fits(offset, len)
+    && TWI_read_regs(DS1307_ADDR, DS1307_NVRAM_REG + offset, buf, len);
+}
+
+bool
+ds1307_nvram_write(uint8_t offset, const uint8_t *buf, uint8_t len)
+{
+  return nvram_fits(offset, len)
+    && TWI_write_regs(DS1307_ADDR, DS1307_NVRAM_REG + offset, buf, len);
+}
+
+/* **************************************** */
+
+bool
+ds1307_sqw(bool on)
+{
+  return TWI_write_reg(DS1307_ADDR, SQW_CONTROL_REG,
+                       on ? _BV(SQW_SQWE) | SQW_RS1_RS0_1Hz : _BV(SQW_OUT));
+}
+
+bool
+ds1307_init(bool interrupts)
+{
+  /* Tell the DS1307 to start the oscillator (turn off CLOCK HALT) in
+   * case it has lost power. */
+  uint8_t reg0;
+
+  TWI_set_speed(DS1307_ADDR, TWI_SPEED(DS1307_SCL_CLOCK));
+
+  if(!TWI_read_regs(DS1307_ADDR, 0x0, &reg0, 1)) return false;
+
+  /* Turn off the clock halt if necessary. */
+  if(reg0 & _BV(CLOCK_HALT)) {
+    if(!TWI_write_reg(DS1307_ADDR, 0x0, reg0 & ~_BV(CLOCK_HALT))) return false;
+  }
+
+  /* Fire up the 1Hz interrupt. */
+  if(interrupts) {
+    if(!ds1307_sqw(true)) return false;
+  }
+
+  return true;
+}
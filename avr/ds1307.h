@@ -33,6 +33,9 @@
 #define _ds1307_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
 
 #include "TWI.h"
 
@@ -41,6 +44,9 @@
 /* DS1307-specifics: twi address 0b1101000. Note: shifted left 1. */
 #define DS1307_ADDR  0xD0
 
+/* The DS1307 only does standard mode. */
+#define DS1307_SCL_CLOCK 100000L
+
 /* reg0: Turns the clock oscillator on/off. */
 #define CLOCK_HALT   7
 
@@ -61,135 +67,47 @@
 #define fromBCD(x) (((x) >> 4) * 10 + ((x) & 0xF))
 #define toBCD(x)   ((((x) / 10) << 4) | ((x) % 10))
 
-/* FIXME add bit widths */
 struct ds1307_time_t {
-  uint8_t seconds;
-  uint8_t minutes;
-  uint8_t hours;
-  uint8_t day;
-  uint8_t date;
-  uint8_t month;
-  uint8_t year;
+  uint8_t seconds;      /* 0-59 */
+  uint8_t minutes;      /* 0-59 */
+  uint8_t hours;        /* 0-23 */
+  uint8_t day;          /* 1-7 */
+  uint8_t date;         /* 1-31 */
+  uint8_t month;        /* 1-12 */
+  uint8_t year;         /* 0-99 */
+  bool twelve_hour;
 };
 
 /* **************************************** */
+/* Battery-backed RAM: registers 0x08-0x3F. */
+
+#define DS1307_NVRAM_REG 0x08
+#define DS1307_NVRAM_LEN 56
+
+/* **************************************** */
+
+/* Read the time. Hours are always 0-23; twelve_hour says which mode
+   the chip keeps them in. */
+bool ds1307_read(struct ds1307_time_t *time_data);
+
+/* Is this a time the DS1307 can keep? The year is 2000-2099, so every
+   fourth one is a leap year. */
+bool ds1307_valid(const struct ds1307_time_t *time_data);
+
+/* Set the time, in the mode given by twelve_hour. False if it's not
+   valid. Starts the oscillator. */
+bool ds1307_write(const struct ds1307_time_t *time_data);
+
+/* Burst access to the NVRAM, offset 0 being register 0x08. False if
+   the range doesn't fit. */
+bool ds1307_nvram_read(uint8_t offset, uint8_t *buf, uint8_t len);
+bool ds1307_nvram_write(uint8_t offset, const uint8_t *buf, uint8_t len);
+
+/* The 1Hz square wave on SQW/OUT, or hold it high (open drain, so
+   the pull-up isn't drawing current). */
+bool ds1307_sqw(bool on);
 
-static inline bool
-ds1307_read(struct ds1307_time_t *time_data)
-{
-  uint8_t twsr;
-  uint8_t data;
-
-  /* Tell the DS1307 we want to read starting at address 0. */
-  if(!TWI_start(DS1307_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, 0x0)) goto error;
-  /* Commence the read. */
-  if(!TWI_rep_start(DS1307_ADDR, &twsr, READ)) goto error;
-
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  time_data->seconds = fromBCD(data & ~_BV(CLOCK_HALT));
-
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  time_data->minutes = fromBCD(data);
-
-  /* Read the hours register. */
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  if(data & TWELVE_HOUR) {
-    uint8_t hours = fromBCD(data & 0x1F);
-    if(data & AMPM) {
-      hours += 12;
-    }
-    time_data->hours = hours;
-  } else {
-    time_data->hours = fromBCD(data);
-  }
-
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  time_data->day = fromBCD(data);
-
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  time_data->date = fromBCD(data);
-
-  if(!TWI_read(&twsr, &data, true)) goto error;
-  time_data->month = fromBCD(data);
-
-  /* Last read, send NACK. */
-  if(!TWI_read(&twsr, &data, false)) goto error;
-  time_data->year = fromBCD(data);
-
-  TWI_send_stop(&twsr);
-  return true;
-
- error:
-
-  TWI_send_stop(&twsr);
-  return false;
-}
-
-/* FIXME Assumes the time is sane and is a bit hardwired. */
-static inline bool
-ds1307_write(struct ds1307_time_t *time_data)
-{
-  uint8_t twsr;
-
-  /* Tell the DS1307 we want to start writing at address 0. */
-  if(!TWI_start(DS1307_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, 0x0)) goto error;
-  /* Keep the oscillator running. */
-  if(!TWI_write(&twsr, toBCD(time_data->seconds) & ~_BV(CLOCK_HALT))) goto error;
-  if(!TWI_write(&twsr, toBCD(time_data->minutes))) goto error;
-  /* FIXME 24hr time. */
-  if(!TWI_write(&twsr, toBCD(time_data->hours))) goto error;
-  if(!TWI_write(&twsr, toBCD(time_data->day))) goto error;
-  if(!TWI_write(&twsr, toBCD(time_data->date))) goto error;
-  if(!TWI_write(&twsr, toBCD(time_data->month))) goto error;
-  if(!TWI_write(&twsr, toBCD(time_data->year))) goto error;
-
-  TWI_send_stop(&twsr);
-  return true;
-
- error:
-
-  TWI_send_stop(&twsr);
-  return false;
-}
-
-/* Initialise the DS11307. Assumes the TWI interface is already initialised. */
-static inline bool
-ds1307_init(bool interrupts)
-{
-  /* Tell the DS1307 to start the oscillator (turn off CLOCK HALT) in
-   * case it has lost power. */
-  uint8_t twsr;
-  uint8_t reg0;
-
-  /* Address, say read from memory slot 0, then read data. */
-  if(!TWI_start(DS1307_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, 0x0)) goto error;
-  if(!TWI_rep_start(DS1307_ADDR, &twsr, READ)) goto error;
-  if(!TWI_read(&twsr, &reg0, false)) goto error;
-
-  /* Turn off the clock halt if necessary. */
-  if(reg0 & _BV(CLOCK_HALT)) {
-    if(!TWI_start(DS1307_ADDR, &twsr, WRITE)) goto error;
-    if(!TWI_write(&twsr, 0x0)) goto error;
-    if(!TWI_write(&twsr, reg0 & ~_BV(CLOCK_HALT))) goto error;
-  }
-
-  /* Fire up the 1Hz interrupt. */
-  if(interrupts) {
-    if(!TWI_start(DS1307_ADDR, &twsr, WRITE)) goto error;
-    if(!TWI_write(&twsr, SQW_CONTROL_REG)) goto error;
-    if(!TWI_write(&twsr, _BV(SQW_SQWE) | SQW_RS1_RS0_1Hz)) goto error;
-  }
-
-  TWI_send_stop(&twsr);
-
-  return true;
-
- error:
-  TWI_send_stop(&twsr);
-  return false;
-}
+/* Initialise the DS1307. Assumes the TWI interface is already initialised. */
+bool ds1307_init(bool interrupts);
 
 #endif /* _ds1307_H_ */
@@ -57,12 +57,12 @@ extern "C" {
 #define DS18B20_11_BIT_UNDF       ((1<<0))
 #define DS18B20_12_BIT_UNDF       0
 
-// conversion times in milliseconds
+// conversion times in milliseconds, rounded up
 #define DS18B20_TCONV_12BIT       750
-#define DS18B20_TCONV_11BIT       DS18B20_TCONV_12_BIT/2
-#define DS18B20_TCONV_10BIT       DS18B20_TCONV_12_BIT/4
-#define DS18B20_TCONV_9BIT        DS18B20_TCONV_12_BIT/8
-#define DS18S20_TCONV             DS18B20_TCONV_12_BIT
+#define DS18B20_TCONV_11BIT       ((DS18B20_TCONV_12BIT+1)/2)
+#define DS18B20_TCONV_10BIT       ((DS18B20_TCONV_12BIT+3)/4)
+#define DS18B20_TCONV_9BIT        ((DS18B20_TCONV_12BIT+7)/8)
+#define DS18S20_TCONV             DS18B20_TCONV_12BIT
 
 // constant to convert the fraction bits to cel*(10^-4)
 #define DS18X20_FRACCONV          625
@@ -0,0 +1,102 @@
+/*
+ * Events from interrupt handlers to the Esterel controller.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "events.h"
+#include "static_assert.h"
+#include "timers.h"
+
+/* **************************************** */
+
+#define EVENTS_MASK (EVENTS_LEN - 1)
+
+#if EVENTS_LEN & EVENTS_MASK
+#error "EVENTS_LEN must be a power of two"
+#endif
+
+/* Room for every type, plus the one being popped. */
+STATIC_ASSERT(EVENTS_LEN > EVENT_TYPES + 1);
+
+static volatile struct event_t queue[EVENTS_LEN];
+static volatile uint8_t queue_head, queue_tail;
+
+/* For each type, one more than its queue slot, or 0 if not queued. */
+static volatile uint8_t queued[EVENT_TYPES];
+
+/* The consumer's. */
+static struct events_stats_t stats[EVENT_TYPES];
+
+/* **************************************** */
+
+void
+events_push(event_type_t type)
+{
+  uint8_t i = queued[type];
+
+  if(i) {
+    i--;
+    if(queue[i].count < UINT8_MAX) {
+      queue[i].count++;
+    }
+  } else {
+    i = queue_tail;
+    queue[i].type = type;
+    queue[i].count = 1;
+    queue[i].time = timers_now();
+    queued[type] = i + 1;
+    /* Publish the entry last. */
+    queue_tail = (i + 1) & EVENTS_MASK;
+  }
+}
+
+/* **************************************** */
+
+/*
+ * Each step is a single byte store, or reads what the producer no
+ * longer writes: once queued[] no longer points at the entry, an
+ * interrupt of its type queues a new one at the tail instead of
+ * bumping this count. The slot isn't handed back until we're done.
+ */
+bool
+events_pop(struct event_t *e)
+{
+  uint8_t i = queue_head;
+  uint32_t latency;
+
+  if(i == queue_tail) {
+    return false;
+  }
+
+  e->type = queue[i].type;
+  queued[e->type] = 0;
+  e->count = queue[i].count;
+  e->time = queue[i].time;
+  queue_head = (i + 1) & EVENTS_MASK;
+
+  stats[e->type].occurred += e->count;
+  stats[e->type].coalesced += e->count - 1;
+  latency = timers_now() - e->time;
+  if(latency > stats[e->type].latency_max) {
+    stats[e->type].latency_max = latency;
+  }
+
+  return true;
+}
+
+bool
+events_pending(void)
+{
+  return queue_head != queue_tail;
+}
+
+void
+events_get_stats(event_type_t type, struct events_stats_t *s)
+{
+  *s = stats[type];
+}
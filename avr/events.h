@@ -0,0 +1,60 @@
+/*
+ * Events from interrupt handlers to the Esterel controller.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* **************************************** */
+
+typedef enum {
+  EVENT_TIMER,
+  EVENT_ACCELEROMETER,
+  EVENT_UART,
+  EVENT_TYPES
+} event_type_t;
+
+/*
+ * An event is queued at most once per type: if it fires again before
+ * the main loop gets to it, the queued entry's count goes up instead.
+ * The counts are totted up for events_get_stats().
+ */
+struct event_t {
+  event_type_t type;
+  uint8_t count;       /* Times it fired, at most UINT8_MAX. */
+  uint32_t time;       /* timers_now() when it first did. */
+};
+
+/* Slots in the queue, a power of two: a ring of N slots holds N - 1
+   entries, and while the main loop pops one type the same type can be
+   queued again behind it. Coalescing means it can never overflow. */
+#ifndef EVENTS_LEN
+#define EVENTS_LEN 8
+#endif
+
+/* Per type. These wrap. */
+struct events_stats_t {
+  uint16_t occurred;   /* Times the event fired. */
+  uint16_t coalesced;  /* ... while one was already queued. */
+  uint32_t latency_max; /* Longest from queued to popped, in ms as
+                           timers_now() counts them. */
+};
+
+/* **************************************** */
+
+/* Interrupt handlers only: they don't nest, which makes them the
+   single producer. */
+void events_push(event_type_t type);
+
+/* The main loop only, the consumer. Neither side disables interrupts. */
+bool events_pop(struct event_t *e);
+bool events_pending(void);
+void events_get_stats(event_type_t type, struct events_stats_t *stats);
+
+#endif /* _EVENTS_H_ */
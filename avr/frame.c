@@ -0,0 +1,141 @@
+/*
+ * Binary frames on the serial port, see ../include/frame.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc8.h"
+#include "frame.h"
+#include "timers.h"
+#include "uart.h"
+
+/* **************************************** */
+
+typedef enum {
+  F_IDLE,
+  F_LEN,
+  F_OPCODE,
+  F_SEQ,
+  F_PAYLOAD,
+  F_CRC
+} frame_state_t;
+
+static frame_state_t state;
+static uint8_t pos;
+
+/* LEN, OPCODE, SEQ, PAYLOAD: what the CRC covers. */
+static uint8_t buf[3 + FRAME_MAX_PAYLOAD];
+
+/* The SEQ to answer with. */
+static uint8_t seq;
+
+/* **************************************** */
+
+bool
+frame_active(void)
+{
+  return state != F_IDLE;
+}
+
+void
+frame_reset(void)
+{
+  state = F_IDLE;
+  timer_stop(TIMER_FRAME);
+}
+
+void
+frame_timer(void)
+{
+  if(state != F_IDLE) {
+    uart_debug_putstringP(PSTR("frame timed out"));
+    state = F_IDLE;
+  }
+}
+
+void
+frame_rx(uint8_t c)
+{
+  switch(state) {
+  case F_IDLE:
+    if(c == FRAME_SOF) {
+      state = F_LEN;
+    }
+    break;
+
+  case F_LEN:
+    if(c == FRAME_SOF) {
+      /* The one before was noise: this is the start. */
+    } else if(c > FRAME_MAX_PAYLOAD) {
+      /* Can't be a frame of ours. */
+      state = F_IDLE;
+    } else {
+      buf[0] = c;
+      state = F_OPCODE;
+    }
+    break;
+
+  case F_OPCODE:
+    buf[1] = c;
+    state = F_SEQ;
+    break;
+
+  case F_SEQ:
+    buf[2] = c;
+    pos = 3;
+    state = buf[0] ? F_PAYLOAD : F_CRC;
+    break;
+
+  case F_PAYLOAD:
+    buf[pos++] = c;
+    if(pos == 3 + buf[0]) {
+      state = F_CRC;
+    }
+    break;
+
+  case F_CRC:
+    state = F_IDLE;
+    seq = buf[2];
+    if(crc8(buf, 3 + buf[0]) == c) {
+      frame_execute(buf[1], &buf[3], buf[0]);
+    } else {
+      frame_reply(buf[1], FRAME_BAD_CRC, NULL, 0);
+    }
+    break;
+  }
+
+  if(state == F_IDLE) {
+    timer_stop(TIMER_FRAME);
+  } else {
+    timer_start(TIMER_FRAME, FRAME_TIMEOUT_MS, 0, NULL);
+  }
+}
+
+void
+frame_reply(uint8_t opcode, frame_status_t status, const uint8_t *payload, uint8_t len)
+{
+  uint8_t out[4 + FRAME_MAX_PAYLOAD];
+
+  if(len > FRAME_MAX_PAYLOAD - 1) {
+    len = FRAME_MAX_PAYLOAD - 1;
+  }
+
+  out[0] = len + 1;
+  out[1] = opcode | FRAME_REPLY;
+  out[2] = seq;
+  out[3] = status;
+  if(len) {
+    memcpy(&out[4], payload, len);
+  }
+
+  uart_tx(FRAME_SOF);
+  for(uint8_t i = 0; i < 4 + len; i++) {
+    uart_tx(out[i]);
+  }
+  uart_tx(crc8(out, 4 + len));
+}
@@ -0,0 +1,42 @@
+/*
+ * Binary frames on the serial port, see ../include/frame.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _AVR_FRAME_H_
+#define _AVR_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../include/frame.h"
+
+/* **************************************** */
+
+/* A frame arrives in one go, a few milliseconds a byte at 9600 baud.
+   If the rest hasn't come this long after the last byte, it isn't
+   going to, and the next SOF starts afresh. */
+#define FRAME_TIMEOUT_MS 250
+
+/* Are we part way through receiving a frame? */
+bool frame_active(void);
+
+/* Take the next character of a frame, the first being FRAME_SOF. A
+   complete frame with a good CRC is handed to frame_execute(). */
+void frame_rx(uint8_t c);
+
+/* Forget any partial frame. */
+void frame_reset(void);
+
+/* TIMER_FRAME expired. */
+void frame_timer(void);
+
+/* Send a reply: opcode | FRAME_REPLY, the status, then the payload. */
+void frame_reply(uint8_t opcode, frame_status_t status, const uint8_t *payload, uint8_t len);
+
+/* Supplied by the command interpreter. */
+void frame_execute(uint8_t opcode, const uint8_t *payload, uint8_t len);
+
+#endif /* _AVR_FRAME_H_ */
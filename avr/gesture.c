@@ -0,0 +1,218 @@
+/*
+ * Shake, double-tap and face-down detection from accelerometer samples.
+ *
+ * Everything is integer arithmetic on the raw 6-bit readings. The Z
+ * filter is fixed point with 4 fractional bits.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+#include "gesture.h"
+#include "mma7660fc.h"
+
+/* **************************************** */
+
+/* As for plain capture, but with tap detection on all axes and shake
+   detection, so TILT reports them. */
+static const struct mma7660fc_reg_t gesture_script[] PROGMEM = {
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  { MMA7660FC_SPCNT_REG, 0x0 },
+  { MMA7660FC_INTSU_REG, _BV(MMA7660FC_INTSU_GINT) | _BV(MMA7660FC_INTSU_SHINTX) | _BV(MMA7660FC_INTSU_SHINTY) | _BV(MMA7660FC_INTSU_SHINTZ) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  { MMA7660FC_SR_REG,    MMA7660FC_SR_AMPD },
+  /* The XDA/YDA/ZDA bits disable an axis, so leave them clear. */
+  { MMA7660FC_PDET_REG,  MMA7660FC_PDET_PDTH(12) },
+  { MMA7660FC_PD_REG,    MMA7660FC_PD_REG_VAL(9) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP) },
+  { MMA7660FC_SCRIPT_END, 0 }
+};
+
+static bool active;
+
+/* The previous sample, for the shake detector. */
+static bool primed;
+static int8_t px, py, pz;
+
+static uint8_t shake_bucket;
+static uint8_t shake_holdoff;
+
+/* Samples since the first of a pair of taps, if armed. */
+static bool tap_armed;
+static uint8_t tap_gap;
+
+/* Low-passed Z, 4 fractional bits. */
+static int16_t zf;
+static uint8_t down_count;
+static bool face_down;
+
+/* **************************************** */
+
+static inline uint8_t
+abs8(int8_t v)
+{
+  return v < 0 ? -v : v;
+}
+
+void
+gesture_reset(void)
+{
+  primed = false;
+  shake_bucket = 0;
+  shake_holdoff = 0;
+  tap_armed = false;
+  zf = 0;
+  down_count = 0;
+  face_down = false;
+}
+
+static bool
+gesture_shake(const struct mma7660fc_sample_t *s)
+{
+  bool hit = s->tilt & _BV(MMA7660FC_TILT_SHAKE);
+
+  if(primed) {
+    uint8_t delta = abs8(s->x - px) + abs8(s->y - py) + abs8(s->z - pz);
+    hit = hit || delta >= GESTURE_SHAKE_DELTA;
+  }
+
+  px = s->x;
+  py = s->y;
+  pz = s->z;
+  primed = true;
+
+  if(shake_holdoff > 0) {
+    shake_holdoff--;
+    return false;
+  }
+
+  if(hit) {
+    shake_bucket += GESTURE_SHAKE_HIT;
+  } else if(shake_bucket > 0) {
+    shake_bucket--;
+  }
+
+  if(shake_bucket >= GESTURE_SHAKE_FULL) {
+    shake_bucket = 0;
+    shake_holdoff = GESTURE_SHAKE_HOLDOFF;
+    return true;
+  }
+
+  return false;
+}
+
+static bool
+gesture_double_tap(const struct mma7660fc_sample_t *s)
+{
+  bool tap = s->tilt & _BV(MMA7660FC_TILT_TAP);
+
+  if(tap_armed && tap_gap < 255) {
+    tap_gap++;
+  }
+
+  if(!tap) {
+    if(tap_armed && tap_gap > GESTURE_TAP_MAX) {
+      tap_armed = false;
+    }
+    return false;
+  }
+
+  if(!tap_armed) {
+    tap_armed = true;
+    tap_gap = 0;
+  } else if(tap_gap >= GESTURE_TAP_MIN) {
+    tap_armed = false;
+    return true;
+  }
+
+  /* Else the same tap still ringing. */
+  return false;
+}
+
+static bool
+gesture_face_down(const struct mma7660fc_sample_t *s)
+{
+  zf += ((int16_t)s->z * 16 - zf) / 8;
+
+  if(face_down) {
+    if(zf > GESTURE_FACE_UP_Z * 16) {
+      face_down = false;
+    }
+    return false;
+  }
+
+  if(   zf < GESTURE_FACE_DOWN_Z * 16
+     && abs8(s->x) <= GESTURE_FACE_DOWN_XY
+     && abs8(s->y) <= GESTURE_FACE_DOWN_XY) {
+    if(++down_count >= GESTURE_FACE_DOWN_LEN) {
+      down_count = 0;
+      face_down = true;
+      return true;
+    }
+  } else {
+    down_count = 0;
+  }
+
+  return false;
+}
+
+uint8_t
+gesture_feed(const struct mma7660fc_sample_t *sample)
+{
+  uint8_t g = 0;
+
+  if(gesture_shake(sample)) {
+    g |= GESTURE_SHAKE;
+  }
+  if(gesture_double_tap(sample)) {
+    g |= GESTURE_DOUBLE_TAP;
+  }
+  if(gesture_face_down(sample)) {
+    g |= GESTURE_FACE_DOWN;
+  }
+
+  return g;
+}
+
+/* **************************************** */
+
+bool
+gesture_start(void)
+{
+  gesture_reset();
+  active = mma7660fc_capture_start_script(gesture_script);
+
+  return active;
+}
+
+bool
+gesture_stop(void)
+{
+  active = false;
+
+  return mma7660fc_capture_stop();
+}
+
+bool
+gesture_active(void)
+{
+  return active;
+}
+
+uint8_t
+gesture_poll(void)
+{
+  struct mma7660fc_sample_t sample;
+  uint8_t g = 0;
+
+  while(mma7660fc_capture_read(&sample)) {
+    g |= gesture_feed(&sample);
+  }
+
+  return g;
+}
@@ -0,0 +1,66 @@
+/*
+ * Shake, double-tap and face-down detection from accelerometer samples.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _GESTURE_H_
+#define _GESTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mma7660fc.h"
+
+/* **************************************** */
+/* Tuning, in MMA7660FC counts (about 21 per g) and samples (120 per
+   second in capture mode). */
+
+/* Sum of the absolute axis changes between samples that counts as a
+   jolt. */
+#define GESTURE_SHAKE_DELTA    24
+/* Each jolt (or device-reported shake) adds this to a bucket that
+   leaks one per sample; a shake is a full bucket. */
+#define GESTURE_SHAKE_HIT       4
+#define GESTURE_SHAKE_FULL     16
+/* Quiet time after a shake before another can be reported. */
+#define GESTURE_SHAKE_HOLDOFF 120
+
+/* Two taps make a double-tap if they are this far apart. Closer is
+   the same tap. */
+#define GESTURE_TAP_MIN         6
+#define GESTURE_TAP_MAX        60
+
+/* Face down: Z below this, X and Y within this of zero, for this
+   long. Face up again once Z rises above GESTURE_FACE_UP_Z. */
+#define GESTURE_FACE_DOWN_Z   (-16)
+#define GESTURE_FACE_DOWN_XY    8
+#define GESTURE_FACE_DOWN_LEN  60
+#define GESTURE_FACE_UP_Z     (-8)
+
+/* **************************************** */
+
+typedef enum {
+  GESTURE_SHAKE      = _BV(0),
+  GESTURE_DOUBLE_TAP = _BV(1),
+  GESTURE_FACE_DOWN  = _BV(2),
+} gesture_t;
+
+/* Forget everything seen so far. */
+void gesture_reset(void);
+
+/* Classify one sample. Returns the gestures (a bitmask of gesture_t)
+   that it completes. */
+uint8_t gesture_feed(const struct mma7660fc_sample_t *sample);
+
+/* Capture samples at 120/s with the device's tap and shake detection
+   on, and classify them in gesture_poll(). */
+bool gesture_start(void);
+bool gesture_stop(void);
+bool gesture_active(void);
+
+/* Run the captured samples through gesture_feed(). */
+uint8_t gesture_poll(void);
+
+#endif /* _GESTURE_H_ */
@@ -42,39 +42,41 @@ FIXME slow down the CPU - 500kHz? TWI / UART might be the limit.
 
 #include "sp0256.h"
 
-// FIXME 10kHz I2C clock.
-// #define SCL_CLOCK  400000L
-#define SCL_CLOCK  10000L
+/* Standard-mode I2C for devices that don't know better. F_CPU caps
+   this, see TWI.h. */
+#define SCL_CLOCK  100000L
 
 #include "TWI.h"
 #include "TWI_init.h"
 
+#include "alarms.h"
+#include "clock.h"
 #include "ds1307.h"
+#include "events.h"
+#include "frame.h"
+#include "gesture.h"
 #include "mma7660fc.h"
+#include "temp.h"
+#include "timebase.h"
+#include "timers.h"
 
 #include "commands.h"
 
 /* **************************************** */
 /* The Esterel controller defines these. */
 
-extern void CONTROLLER_I_wdt_event(void);
+extern void CONTROLLER_I_housekeeping_timer(void);
+extern void CONTROLLER_I_uart_idle_timer(void);
 extern void CONTROLLER_I_accelerometer_event(void);
 extern void CONTROLLER_I_uart_event(void);
+extern void CONTROLLER_I_shake_event(void);
+extern void CONTROLLER_I_double_tap_event(void);
+extern void CONTROLLER_I_face_down_event(void);
+extern void CONTROLLER_I_temperature_event(void);
 
 void CONTROLLER_reset(void);
 void CONTROLLER(void);
 
-/* **************************************** */
-/* FIXME double-buffer events. */
-
-struct events_t {
-  bool event_accelerometer:1;
-  bool event_uart:1;
-  bool event_wdt:1;
-};
-
-static struct events_t events;
-
 /* **************************************** */
 /* Interrupt handlers */
 
@@ -82,29 +84,54 @@ static struct events_t events;
 ISR(PCINT0_vect)
 {
   // uart_debug_putstringP(PSTR("PCINT0"));
+  sp0256_isr();
 }
 
-/* accelerometer event - PC3 - PCINT11 - PCI1 */
+/* accelerometer event - PC3 - PCINT11 - PCI1
+   RTC 1Hz square wave - PC2 - PCINT10 - PCI1 */
+static uint8_t pinc_last;
+
 ISR(PCINT1_vect)
 {
-  uart_debug_putstringP(PSTR("PCINT1"));
-  events.event_accelerometer = true;
+  uint8_t pinc = PINC;
+  uint8_t changed = pinc ^ pinc_last;
+
+  pinc_last = pinc;
+
+  if(changed & TIMEBASE_SQW_PIN) {
+    timebase_sqw_isr();
+  }
+
+  /* If we can't tell what changed, assume it was the accelerometer. */
+  if(!(changed & TIMEBASE_SQW_PIN) || (changed & MMA7660FC_INT)) {
+    if(mma7660fc_capturing()) {
+      /* 120 times a second, so no chatter. */
+      mma7660fc_capture_isr();
+    } else {
+      uart_debug_putstringP(PSTR("PCINT1"));
+      events_push(EVENT_ACCELEROMETER);
+    }
+  }
 }
 
+/* Someone is talking to us on the serial port: stay in idle sleep,
+   where the USART runs, until TIMER_UART_IDLE. The character that
+   woke us from power-down is lost. */
+static volatile bool uart_listening;
+
 /* U(S)ART receive activity - PCINT16 - PCI2 */
 ISR(PCINT2_vect)
 {
   uart_debug_putstringP(PSTR("PCINT2"));
-  /* FIXME: if we're being talked to on the serial port, stay awake for a while. */
-  wdt_reset();
-  events.event_uart = true;
+  uart_listening = true;
+  timer_start(TIMER_UART_IDLE, TIMER_UART_IDLE_MS, 0, NULL);
+  events_push(EVENT_UART);
 }
 
 /* Watch-dog timeout. */
 ISR(WDT_vect) {
   uart_debug_putstringP(PSTR("WATCH DOG"));
-  wdt_reset();
-  events.event_wdt = true;
+  timers_isr();
 }
 
 /* **************************************** */
@@ -114,6 +141,11 @@ void
 check_alarm(void)
 {
   uart_debug_putstringP(PSTR("check_alarm()"));
+
+  if(alarms_check()) {
+    uart_debug_putstringP(PSTR("Alarm!"));
+    speak_the_time();
+  }
 }
 
 /* **************************************** */
@@ -121,17 +153,38 @@ check_alarm(void)
 void
 sleep(void)
 {
+  /* Accelerometer samples are fetched over TWI by interrupt handlers,
+     which needs the TWI clock running. Timer2 and the USART stop in
+     power-down too. */
+  bool idle = mma7660fc_capturing() || timebase_fine_running() || uart_listening;
+
   uart_debug_putstringP(PSTR("going to sleep"));
-  TWI_turn_off();
-  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-  sleep_enable();
-  sleep_cpu();
+  /* The USART stops in power-down, so let the TX FIFO drain first. */
+  uart_tx_flush();
+  if(idle) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+  } else {
+    TWI_turn_off();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  }
+  /* Don't sleep on an event that arrived since we last looked. */
+  cli();
+  if(!events_pending()) {
+    timebase_bench_sleep();
+    sleep_enable();
+    sei();
+    sleep_cpu();
 
-  /* ... and when we come back ... */
+    /* ... and when we come back ... */
 
-  sleep_disable();
+    sleep_disable();
+    timebase_bench_wake();
+  }
+  sei();
   uart_debug_putstringP(PSTR("woke up"));
-  TWI_init();
+  if(!idle) {
+    TWI_init();
+  }
 }
 
 int
@@ -166,11 +219,11 @@ main(void)
 
   PCICR = 0x0;
 
-  /* Set up the watch-dog timer: interrupt (do not reset the system), 8s timeout. */
-  wdt_reset();
+  /* Set up the watch-dog timer: interrupt (do not reset the system),
+     reprogrammed for each timer deadline. */
   MCUCR &= ~_BV(WDRF);
-  WDTCSR = _BV(WDCE) | _BV(WDE);
-  WDTCSR =  _BV(WDIE) | _BV(WDP0) | _BV(WDP3);
+  timer_start(TIMER_HOUSEKEEPING, TIMER_HOUSEKEEPING_MS, TIMER_HOUSEKEEPING_MS, NULL);
+  timers_init();
 
   uart_init();
   uart_putstringP(PSTR("Talking clock."), true);
@@ -186,6 +239,12 @@ main(void)
   uart_debug_putstringP(PSTR("Initialising the RTC (ds1307)..."));
   if(ds1307_init(false)) {
     uart_debug_putstringP(PSTR("The RTC (ds1307) is initialised."));
+    clock_init();
+    alarms_load();
+
+    if(TIMEBASE_DEFAULT != TIMEBASE_WDT && !timebase_select(TIMEBASE_DEFAULT)) {
+      uart_debug_putstringP(PSTR("** Couldn't switch time base."));
+    }
   } else {
     uart_debug_putstringP(PSTR("** The RTC (ds1307) failed to initialise."));
   }
@@ -201,6 +260,13 @@ main(void)
     uart_debug_putstringP(PSTR("** The accelerometer (mma7660) failed to initialise."));
   }
 
+  uart_debug_putstringP(PSTR("Initialising the thermometer (ds18b20)..."));
+  if(temp_init()) {
+    uart_debug_putstringP(PSTR("The thermometer (ds18b20) is initialised."));
+  } else {
+    uart_debug_putstringP(PSTR("** The thermometer (ds18b20) failed to initialise."));
+  }
+
   uart_debug_putstringP(PSTR("Initialising the SP0256..."));
   sp0256_init();
   uart_debug_putstringP(PSTR("The SP0256 is initialised."));
@@ -208,52 +274,94 @@ main(void)
   /* Enable interrupts after initialising everything. */
   sei();
 
-  sp0256_turn_on();
   speak_P(talking_clock);
-  sp0256_turn_off();
 
   uart_debug_putstringP(PSTR("Resetting the Esterel controller."));
   CONTROLLER_reset();
 
+  timebase_bench_wake();
+
   while(1) {
     sleep();
+    timebase_bench_report();
 
     /*
 
        The Esterel controller cannot cope with new events occurring
-       while it is processing a reaction.
-
-       One non-solution: disable interrupts while it is running. This
-       also disables interrupts while we do what the controller tells
-       us to do, which might limit implementation options there.
+       while it is processing a reaction, so interrupt handlers queue
+       them (see events.h) and each reaction gets a snapshot. Events
+       that arrive during a reaction get another one before we sleep.
 
-       So double-buffering it must be. Marshall the events here.
-
-       FIXME we need to loop here if we're talking, as many events
-       could occur during those seconds. We can't go straight back to
-       sleep in all cases.
+       Speech is queued and fed to the SP0256 from the SBY pin change
+       interrupt, so the controller no longer stalls for seconds while
+       we talk. That interrupt also wakes us up, though. Likewise
+       temperature conversions finish on a timer, see temp.h.
 
     */
 
-    if(events.event_accelerometer) {
-      CONTROLLER_I_accelerometer_event();
-      events.event_accelerometer = 0;
-    }
-    if(events.event_uart) {
-      CONTROLLER_I_uart_event();
-      events.event_uart = 0;
-    }
-    if(events.event_wdt) {
-      CONTROLLER_I_wdt_event();
-      events.event_wdt = 0;
-    }
-
-    uart_debug_putstringP(PSTR("Entering the Esterel controller."));
-    CONTROLLER();
-    uart_debug_putstringP(PSTR("Exiting the Esterel controller."));
-
-    // FIXME the uart handler clears out the RX buffer...
-    events.event_uart = 0;
+    bool uart_drained = false;
+
+    do {
+      struct event_t e;
+      bool uart = false;
+
+      while(events_pop(&e)) {
+        switch(e.type) {
+        case EVENT_ACCELEROMETER:
+          CONTROLLER_I_accelerometer_event();
+          break;
+        case EVENT_UART:
+          /* handle_uart_event() empties the RX FIFO, so pin changes
+             for characters it has already read should not have it
+             wait for more. */
+          if(!uart_drained || uart_rx_pending()) {
+            CONTROLLER_I_uart_event();
+            uart = true;
+          }
+          break;
+        case EVENT_TIMER: {
+          uint8_t t = timers_expired();
+
+          if(t & _BV(TIMER_HOUSEKEEPING)) {
+            CONTROLLER_I_housekeeping_timer();
+          }
+          if(t & _BV(TIMER_UART_IDLE)) {
+            uart_listening = false;
+            CONTROLLER_I_uart_idle_timer();
+          }
+          if((t & _BV(TIMER_TEMP)) && temp_timer()) {
+            CONTROLLER_I_temperature_event();
+          }
+          if(t & _BV(TIMER_FRAME)) {
+            frame_timer();
+          }
+          break;
+        }
+        default:
+          break;
+        }
+      }
+
+      if(gesture_active()) {
+        uint8_t g = gesture_poll();
+
+        if(g & GESTURE_SHAKE) {
+          CONTROLLER_I_shake_event();
+        }
+        if(g & GESTURE_DOUBLE_TAP) {
+          CONTROLLER_I_double_tap_event();
+        }
+        if(g & GESTURE_FACE_DOWN) {
+          CONTROLLER_I_face_down_event();
+        }
+      }
+
+      uart_debug_putstringP(PSTR("Entering the Esterel controller."));
+      CONTROLLER();
+      uart_debug_putstringP(PSTR("Exiting the Esterel controller."));
+
+      uart_drained = uart;
+    } while(events_pending());
   }
 
     /* FIXME debugging for the moment. */
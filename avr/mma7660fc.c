@@ -38,103 +38,115 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
 #include "mma7660fc.h"
 #include "TWI.h"
 
 /* **************************************** */
-/* Read the tilt status. */
+/* Burst reads. */
 
-bool
-mma7660fc_read_tilt(mma7660fc_tilt_orientation_t *o, mma7660fc_tilt_back_front_t *bf)
+/* Did the device update any of XOUT..TILT while we were reading? */
+static inline bool
+mma7660fc_alert(uint8_t reg, const uint8_t *buf, uint8_t len)
 {
-  uint8_t twsr;
-  uint8_t t;
-
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_TILT_REG)) goto error;
-  if(!TWI_rep_start(MMA7660FC_ADDR, &twsr, READ)) goto error;
-  TWI_read(&twsr, &t, false);
-  TWI_send_stop(&twsr);
+  for(uint8_t i = 0; i < len && reg + i <= MMA7660FC_TILT_REG; i++) {
+    if(buf[i] & _BV(MMA7660FC__OUT_ALERT)) {
+      return true;
+    }
+  }
 
-  // FIXME abstract
-  *o = (t >> 2) & 0x7;
-  *bf = t & 0x3;
+  return false;
+}
 
-  return true;
+bool
+mma7660fc_read_regs(uint8_t reg, uint8_t *buf, uint8_t len)
+{
+  for(uint8_t i = 0; i < READ_AXIS_ATTEMPTS; i++) {
+    if(!TWI_read_regs(MMA7660FC_ADDR, reg, buf, len)) {
+      return false;
+    }
 
- error:
-  TWI_send_stop(&twsr);
+    if(!mma7660fc_alert(reg, buf, len)) {
+      return true;
+    }
+  }
 
   return false;
 }
 
-/* **************************************** */
-/* Ask the accelerometer for the axes readings. */
-
-static inline bool
-mma7660fc_read_axis(int8_t *v, bool final)
+/* The axes are 6-bit two's complement. */
+static inline int8_t
+mma7660fc_axis(uint8_t t)
 {
-  uint8_t twsr;
-
   // Thanks: http://graphics.stanford.edu/~seander/bithacks.html#FixedSignExtend
   struct {signed int f:6;} t6;
-  uint8_t t;
 
-  /* If the alert bit is set a register update by the device has
-   * interfered with our read. */
-  if(TWI_read(&twsr, &t, final) && !(t & _BV(MMA7660FC__OUT_ALERT))) {
-    // FIXME casts??
-    *v = t6.f = t;
-    return true;
-  } else {
-    return false;
-  }
+  // FIXME casts??
+  return t6.f = t;
 }
 
 bool
-mma7660fc_read_axes(int8_t *x, int8_t *y, int8_t *z)
+mma7660fc_read_sample(struct mma7660fc_sample_t *sample)
 {
-  uint8_t twsr;
+  uint8_t t[4];
 
-  for(int i = 0; i < READ_AXIS_ATTEMPTS; i++) {
-    if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-    if(!TWI_write(&twsr, MMA7660FC_XOUT_REG)) goto error;
-    if(!TWI_rep_start(MMA7660FC_ADDR, &twsr, READ)) goto error;
+  if(!mma7660fc_read_regs(MMA7660FC_XOUT_REG, t, sizeof(t))) {
+    return false;
+  }
 
-    if(   mma7660fc_read_axis(x, true)
-       && mma7660fc_read_axis(y, true)
-       && mma7660fc_read_axis(z, false)) {
-      TWI_send_stop(&twsr);
+  sample->x = mma7660fc_axis(t[0]);
+  sample->y = mma7660fc_axis(t[1]);
+  sample->z = mma7660fc_axis(t[2]);
+  sample->tilt = t[3];
 
-      return true;
-    }
+  return true;
+}
+
+/* **************************************** */
+/* Read the tilt status. */
 
-    TWI_send_stop(&twsr);
+bool
+mma7660fc_read_tilt(mma7660fc_tilt_orientation_t *o, mma7660fc_tilt_back_front_t *bf)
+{
+  uint8_t t;
+
+  if(!mma7660fc_read_regs(MMA7660FC_TILT_REG, &t, 1)) {
+    return false;
   }
 
- error:
-  TWI_send_stop(&twsr);
+  *o = mma7660fc_tilt_orientation(t);
+  *bf = mma7660fc_tilt_back_front(t);
 
-  return false;
+  return true;
 }
 
 /* **************************************** */
+/* Ask the accelerometer for the axes readings. */
 
-static inline bool
-mma7660fc_set_mode(MMA7660FC_MODE_t mode)
+bool
+mma7660fc_read_axes(int8_t *x, int8_t *y, int8_t *z)
 {
-  uint8_t twsr;
+  uint8_t t[3];
 
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_MODE_REG)) goto error;
-  if(!TWI_write(&twsr, mode)) goto error;
+  if(!mma7660fc_read_regs(MMA7660FC_XOUT_REG, t, sizeof(t))) {
+    return false;
+  }
 
-  TWI_send_stop(&twsr);
+  *x = mma7660fc_axis(t[0]);
+  *y = mma7660fc_axis(t[1]);
+  *z = mma7660fc_axis(t[2]);
 
   return true;
+}
 
- error:
-  return false;
+/* **************************************** */
+
+static inline void
+mma7660fc_set_speed(void)
+{
+  TWI_set_speed(MMA7660FC_ADDR, TWI_SPEED(MMA7660FC_SCL_CLOCK));
 }
 
 /* **************************************** */
@@ -143,121 +155,236 @@ mma7660fc_set_mode(MMA7660FC_MODE_t mode)
 bool
 mma7660fc_clear_interrupt(void)
 {
-  uint8_t twsr;
   uint8_t t;
 
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_XOUT_REG)) goto error;
-  if(!TWI_rep_start(MMA7660FC_ADDR, &twsr, READ)) goto error;
-  if(!TWI_read(&twsr, &t, false)) goto error;
-  TWI_send_stop(&twsr);
+  return TWI_read_regs(MMA7660FC_ADDR, MMA7660FC_XOUT_REG, &t, 1);
+}
 
-  return true;
+/* **************************************** */
+/* Register scripts. */
 
- error:
-  TWI_send_stop(&twsr);
+bool
+mma7660fc_run_script(const struct mma7660fc_reg_t *script)
+{
+  uint8_t buf[MMA7660FC_PD_REG + 1];
+  uint8_t reg = pgm_read_byte(&script->reg);
+
+  while(reg != MMA7660FC_SCRIPT_END) {
+    uint8_t start = reg;
+    uint8_t len = 0;
+
+    /* Gather a run of consecutive registers. */
+    do {
+      buf[len++] = pgm_read_byte(&script->val);
+      script++;
+      reg = pgm_read_byte(&script->reg);
+    } while(reg == start + len && len < sizeof(buf));
+
+    if(!TWI_write_regs(MMA7660FC_ADDR, start, buf, len)) {
+      return false;
+    }
+  }
 
-  return false;
+  return true;
 }
 
-/* Initialise the MMA7660. Assumes the TWI interface is already initialised.
+/* The device must be placed in standby mode before we can change its
+ * registers. Writing MODE again mid-script keeps SPCNT..PD contiguous,
+ * so the configuration goes out in one transaction.
+ *
  * FIXME tries to set up the tap detection stuff but it doesn't seem to work.
  */
+static const struct mma7660fc_reg_t mma7660fc_tap_script[] PROGMEM = {
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  /* No sleep count. */
+  { MMA7660FC_SPCNT_REG, 0x0 },
+  /* Configure tap detection interrupt. */
+  { MMA7660FC_INTSU_REG, _BV(MMA7660FC_INTSU_PDINT) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  /* 120 samples/s. */
+  { MMA7660FC_SR_REG,    MMA7660FC_SR_AMPD },
+  /* Only Z axis tap detection on, threshold +/-12 counts */
+  { MMA7660FC_PDET_REG,  _BV(MMA7660FC_PDET_XDA) | _BV(MMA7660FC_PDET_YDA) | _BV(MMA7660FC_PDET_ZDA) | MMA7660FC_PDET_PDTH(12) },
+  /* Tap detection debounce count = 9. */
+  { MMA7660FC_PD_REG,    MMA7660FC_PD_REG_VAL(9) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP) },
+  { MMA7660FC_SCRIPT_END, 0 }
+};
+
+/* Try out the orientation detection. */
+static const struct mma7660fc_reg_t mma7660fc_Bryan_script[] PROGMEM = {
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  /* No sleep count. */
+  { MMA7660FC_SPCNT_REG, 0x0 },
+  /* Configure front/back and up/down/right/left interrupts */
+  { MMA7660FC_INTSU_REG, _BV(MMA7660FC_INTSU_FBINT) | _BV(MMA7660FC_INTSU_PLINT) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  /* 8 samples/s, TILT debounce filter = 2. FIXME */
+  { MMA7660FC_SR_REG,    0x34 },
+  /* No tap detection. FIXME suspicious */
+  { MMA7660FC_PDET_REG,  0xE0 },
+  /* Tap detection debounce count = 0. */
+  { MMA7660FC_PD_REG,    MMA7660FC_PD_REG_VAL(0) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP) },
+  { MMA7660FC_SCRIPT_END, 0 }
+};
+
+/* Initialise the MMA7660. Assumes the TWI interface is already initialised. */
 bool
 mma7660fc_init_tap(void)
 {
-  uint8_t twsr;
+  mma7660fc_set_speed();
+  return mma7660fc_run_script(mma7660fc_tap_script);
+}
 
-  /* Device must be placed in standby mode before we can change its registers. */
-  if(!mma7660fc_set_mode(MMA7660FC_MODE_STANDBY)) goto error;
+/* Initialise the MMA7660. Assumes the TWI interface is already initialised. */
+bool
+mma7660fc_init_Bryan(void)
+{
+  mma7660fc_set_speed();
+  return mma7660fc_run_script(mma7660fc_Bryan_script);
+}
 
-  /* No sleep count. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_SPCNT_REG)) goto error;
-  if(!TWI_write(&twsr, 0x0)) goto error;
-  TWI_send_stop(&twsr);
+/* **************************************** */
+/* Sample capture. */
+
+#define CAPTURE_MASK (MMA7660FC_CAPTURE_LEN - 1)
+
+#if MMA7660FC_CAPTURE_LEN & CAPTURE_MASK
+#error "MMA7660FC_CAPTURE_LEN must be a power of two"
+#endif
+
+/* 120 samples/s, no debounce filtering, interrupt on every update. */
+static const struct mma7660fc_reg_t mma7660fc_capture_script[] PROGMEM = {
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  { MMA7660FC_SPCNT_REG, 0x0 },
+  { MMA7660FC_INTSU_REG, _BV(MMA7660FC_INTSU_GINT) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_STANDBY },
+  { MMA7660FC_SR_REG,    MMA7660FC_SR_AMPD },
+  /* No tap detection. */
+  { MMA7660FC_PDET_REG,  0xE0 },
+  { MMA7660FC_PD_REG,    MMA7660FC_PD_REG_VAL(0) },
+  { MMA7660FC_MODE_REG,  MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP) },
+  { MMA7660FC_SCRIPT_END, 0 }
+};
+
+static volatile bool capturing;
+
+static struct mma7660fc_sample_t capture_buf[MMA7660FC_CAPTURE_LEN];
+static volatile uint8_t capture_head, capture_tail;
+static volatile uint16_t capture_dropped;
+
+static uint8_t capture_raw[4];
+
+static void mma7660fc_capture_done(struct TWI_txn_t *txn);
+
+static struct TWI_txn_t capture_txn = {
+  .addr = MMA7660FC_ADDR,
+  .reg = MMA7660FC_XOUT_REG,
+  .rbuf = capture_raw,
+  .rlen = sizeof(capture_raw),
+  .done = mma7660fc_capture_done,
+};
+
+/* Called from the TWI interrupt handler. Reading TILT clears the
+   device's interrupt. */
+static void
+mma7660fc_capture_done(struct TWI_txn_t *txn)
+{
+  uint8_t next = (capture_tail + 1) & CAPTURE_MASK;
+
+  if(   txn->status == TWI_DONE
+     && !mma7660fc_alert(MMA7660FC_XOUT_REG, capture_raw, sizeof(capture_raw))
+     && next != capture_head) {
+    struct mma7660fc_sample_t *sample = &capture_buf[capture_tail];
+
+    sample->x = mma7660fc_axis(capture_raw[0]);
+    sample->y = mma7660fc_axis(capture_raw[1]);
+    sample->z = mma7660fc_axis(capture_raw[2]);
+    sample->tilt = capture_raw[3];
+    capture_tail = next;
+  } else {
+    capture_dropped++;
+  }
+}
 
-  /* Configure tap detection interrupt. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_INTSU_REG)) goto error;
-  if(!TWI_write(&twsr, _BV(MMA7660FC_INTSU_PDINT))) goto error;
-  TWI_send_stop(&twsr);
+void
+mma7660fc_capture_isr(void)
+{
+  /* Pin changes happen on both edges; only the assertion matters. */
+  if(capturing && !(MMA7660FC_INT_IN & MMA7660FC_INT)) {
+    if(!TWI_submit(&capture_txn)) {
+      capture_dropped++;
+    }
+  }
+}
 
-  /* Only Z axis tap detection on, threshold +/-12 counts */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PDET_REG)) goto error;
-  if(!TWI_write(&twsr, _BV(MMA7660FC_PDET_XDA) | _BV(MMA7660FC_PDET_YDA) | _BV(MMA7660FC_PDET_ZDA) | MMA7660FC_PDET_PDTH(12))) goto error;
-  TWI_send_stop(&twsr);
+bool
+mma7660fc_capture_start(void)
+{
+  return mma7660fc_capture_start_script(mma7660fc_capture_script);
+}
 
-  /* 120 samples/s. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_SR_REG)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_SR_AMPD)) goto error;
-  TWI_send_stop(&twsr);
+bool
+mma7660fc_capture_start_script(const struct mma7660fc_reg_t *script)
+{
+  mma7660fc_set_speed();
 
-  /* Tap detection debounce count = 9. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PD_REG)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PD_REG_VAL(9))) goto error;
-  TWI_send_stop(&twsr);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    capture_head = capture_tail = 0;
+    capture_dropped = 0;
+  }
 
-  if(!mma7660fc_set_mode(MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP))) goto error;
+  if(!mma7660fc_run_script(script)) {
+    return false;
+  }
 
-  return true;
+  capturing = true;
 
- error:
-  TWI_send_stop(&twsr);
+  /* If the device asserted its interrupt before we were listening
+     there won't be another edge until it's cleared. */
+  mma7660fc_capture_isr();
 
-  return false;
+  return true;
 }
 
-/* Initialise the MMA7660. Assumes the TWI interface is already initialised.
- * Try out the orientation detection.
- */
 bool
-mma7660fc_init_Bryan(void)
+mma7660fc_capture_stop(void)
 {
-  uint8_t twsr;
-
-  /* Device must be placed in standby mode before we can change its registers. */
-  if(!mma7660fc_set_mode(MMA7660FC_MODE_STANDBY)) goto error;
-
-  /* No sleep count. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_SPCNT_REG)) goto error;
-  if(!TWI_write(&twsr, 0x0)) goto error;
-  TWI_send_stop(&twsr);
-
-  /* Configure front/back and up/down/right/left interrupts */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_INTSU_REG)) goto error;
-  if(!TWI_write(&twsr, _BV(MMA7660FC_INTSU_FBINT) | _BV(MMA7660FC_INTSU_PLINT))) goto error;
-  TWI_send_stop(&twsr);
+  capturing = false;
 
-  /* No tap detection. FIXME suspicious */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PDET_REG)) goto error;
-  if(!TWI_write(&twsr, 0xE0)) goto error;
-  TWI_send_stop(&twsr);
+  /* Queued behind any read still in flight. */
+  return TWI_write_reg(MMA7660FC_ADDR, MMA7660FC_MODE_REG, MMA7660FC_MODE_STANDBY);
+}
 
-  /* 8 samples/s, TILT debounce filter = 2. FIXME */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_SR_REG)) goto error;
-  if(!TWI_write(&twsr, 0x34)) goto error;
-  TWI_send_stop(&twsr);
+bool
+mma7660fc_capturing(void)
+{
+  return capturing;
+}
 
-  /* Tap detection debounce count = 0. */
-  if(!TWI_start(MMA7660FC_ADDR, &twsr, WRITE)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PD_REG)) goto error;
-  if(!TWI_write(&twsr, MMA7660FC_PD_REG_VAL(0))) goto error;
-  TWI_send_stop(&twsr);
+bool
+mma7660fc_capture_read(struct mma7660fc_sample_t *sample)
+{
+  /* The TWI interrupt handler only moves the tail. */
+  if(capture_head == capture_tail) {
+    return false;
+  }
 
-  if(!mma7660fc_set_mode(MMA7660FC_MODE_ACTIVE | _BV(MMA7660FC_MODE_IPP))) goto error;
+  *sample = capture_buf[capture_head];
+  capture_head = (capture_head + 1) & CAPTURE_MASK;
 
   return true;
+}
 
- error:
-  TWI_send_stop(&twsr);
+uint16_t
+mma7660fc_capture_dropped(void)
+{
+  uint16_t dropped;
 
-  return false;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dropped = capture_dropped;
+  }
+
+  return dropped;
 }
@@ -43,6 +43,13 @@
 
 #include <avr/io.h>
 
+/* **************************************** */
+/* Port connections. */
+
+/* The interrupt pin: PC3 - PCINT11 - PCI1. Active low. */
+#define MMA7660FC_INT     (_BV(PC3))
+#define MMA7660FC_INT_IN  PINC
+
 /* **************************************** */
 
 #define READ_AXIS_ATTEMPTS 3
@@ -50,6 +57,9 @@
 /* 7-bit twi address 0b1001100. Note: shifted left 1, as the LSB (8th) is the read/write bit. */
 #define MMA7660FC_ADDR  0x98
 
+/* Fast mode. */
+#define MMA7660FC_SCL_CLOCK 400000L
+
 /* Registers */
 #define MMA7660FC_XOUT_REG  0x00
 #define MMA7660FC_YOUT_REG  0x01
@@ -160,6 +170,22 @@ to match before the device updates portrait/ landscape data in TILT
 
 /* **************************************** */
 
+/* Read len registers starting at reg in one transaction, using the
+   device's auto-increment. If any of XOUT, YOUT, ZOUT or TILT in the
+   span has its alert bit set the device updated it mid-read, so try
+   again, up to READ_AXIS_ATTEMPTS times. */
+bool mma7660fc_read_regs(uint8_t reg, uint8_t *buf, uint8_t len);
+
+/* XOUT through TILT. */
+struct mma7660fc_sample_t {
+  int8_t x;
+  int8_t y;
+  int8_t z;
+  uint8_t tilt;
+};
+
+bool mma7660fc_read_sample(struct mma7660fc_sample_t *sample);
+
 bool mma7660fc_read_axes(int8_t *x, int8_t *y, int8_t *z);
 
 /* FIXME clear the interrupt just by talking to the accelerometer. Unnecessary when we do it for real. */
@@ -179,11 +205,77 @@ typedef enum {
   MMA7660FC_tilt_back = 2,
 } mma7660fc_tilt_back_front_t;
 
+/* Decode the TILT register. */
+static inline mma7660fc_tilt_orientation_t
+mma7660fc_tilt_orientation(uint8_t tilt)
+{
+  return (tilt >> MMA7660FC_TILT_PoLA) & 0x7;
+}
+
+static inline mma7660fc_tilt_back_front_t
+mma7660fc_tilt_back_front(uint8_t tilt)
+{
+  return (tilt >> MMA7660FC_TILT_BaFro) & 0x3;
+}
+
 bool mma7660fc_read_tilt(mma7660fc_tilt_orientation_t *o, mma7660fc_tilt_back_front_t *bf);
 
+/* A register script is a PROGMEM array of register/value pairs
+   terminated by MMA7660FC_SCRIPT_END. Runs of consecutive registers
+   are written in a single auto-incrementing transaction. */
+#define MMA7660FC_SCRIPT_END 0xFF
+
+struct mma7660fc_reg_t {
+  uint8_t reg;
+  uint8_t val;
+};
+
+bool mma7660fc_run_script(const struct mma7660fc_reg_t *script);
+
 /* Initialise the MMA7660. Assumes the TWI interface is already initialised. */
 bool mma7660fc_init_tap(void);
 
 bool mma7660fc_init_Bryan(void);
 
+/* **************************************** */
+/* Sample capture.
+ *
+ * Stream XOUT..TILT at 120 samples/s into an SRAM ring buffer. The
+ * device raises its interrupt after every measurement; the pin change
+ * handler calls mma7660fc_capture_isr(), which queues an asynchronous
+ * TWI read. The TWI must stay powered while capturing, so sleep in
+ * idle rather than power-down.
+ *
+ * If a read fails the device keeps its interrupt asserted and the
+ * capture stalls until it is restarted. The TWI statistics say why.
+ */
+
+/* Samples, must be a power of two. */
+#ifndef MMA7660FC_CAPTURE_LEN
+#define MMA7660FC_CAPTURE_LEN 64
+#endif
+
+/* Reconfigure the device for 120 samples/s with an interrupt per
+   sample and start capturing. */
+bool mma7660fc_capture_start(void);
+
+/* As above with a register script of your own. It must enable the
+   MMA7660FC_INTSU_GINT interrupt. */
+bool mma7660fc_capture_start_script(const struct mma7660fc_reg_t *script);
+
+/* Stop capturing and put the device in standby. Re-initialise it with
+   one of the init functions to get the old behaviour back. */
+bool mma7660fc_capture_stop(void);
+
+bool mma7660fc_capturing(void);
+
+/* Call from the pin change handler. */
+void mma7660fc_capture_isr(void);
+
+/* Take the oldest captured sample. Returns false if there are none. */
+bool mma7660fc_capture_read(struct mma7660fc_sample_t *sample);
+
+/* Samples lost to a full buffer, a busy bus or a failed read. Wraps. */
+uint16_t mma7660fc_capture_dropped(void);
+
 #endif /* _mma7660fc_H_ */
@@ -0,0 +1,34 @@
+/*
+ * What we keep in the DS1307's battery-backed RAM. Unlike the AVR's
+ * EEPROM it doesn't wear out, so it can be written as often as we
+ * like. Its contents are garbage after the battery has gone flat, so
+ * each block starts with a magic byte and is sanity-checked on
+ * loading.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _NVRAM_H_
+#define _NVRAM_H_
+
+#include "alarms.h"
+#include "ds1307.h"
+
+/* **************************************** */
+
+#define NVRAM_MAGIC 0xC1
+
+/* Magic, then the drift correction (int32_t ppm). */
+#define NVRAM_CLOCK      0
+#define NVRAM_CLOCK_LEN  (1 + 4)
+
+/* Magic, count, then the sorted table. */
+#define NVRAM_ALARMS     (NVRAM_CLOCK + NVRAM_CLOCK_LEN)
+#define NVRAM_ALARMS_LEN (2 + ALARMS_MAX * 3)
+
+#if NVRAM_ALARMS + NVRAM_ALARMS_LEN > DS1307_NVRAM_LEN
+#error "Too much for the DS1307's NVRAM"
+#endif
+
+#endif /* _NVRAM_H_ */
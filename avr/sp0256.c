@@ -5,35 +5,207 @@
  * https://creativecommons.org/publicdomain/zero/1.0/
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
-// FIXME cli/sei experiment
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 
 #include <util/delay.h>
+#include <util/delay_basic.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 
 #include "sp0256.h"
 #include "allophones.h"
+#include "timers.h"
 
-void
-speak_allophone(allophone_t allophone)
+/* **************************************** */
+
+#ifndef F_CPU
+#error "Please define the cpu frequency F_CPU"
+#endif
+
+/* _delay_loop_1(0) means 256 iterations. */
+#if SP0256_ALD_LOOPS > 255 || SP0256_RESET_LOOPS > 255
+#error "SP0256 strobe too long for _delay_loop_1() at this F_CPU"
+#endif
+
+/* **************************************** */
+
+#define FIFO_MASK (SP0256_FIFO_LEN - 1)
+
+#if SP0256_FIFO_LEN & FIFO_MASK
+#error "SP0256_FIFO_LEN must be a power of two"
+#endif
+
+static volatile allophone_t fifo[SP0256_FIFO_LEN];
+static volatile uint8_t fifo_head, fifo_tail;
+
+/* We loaded an allophone and SBY hasn't risen since. */
+static volatile bool speaking;
+
+/* sp0256_turn_off() was called while we were speaking. */
+static volatile bool off_pending;
+
+/* The chip is enabled. */
+static volatile bool powered;
+
+static inline void
+sp0256_power_off(void)
+{
+  /* Don't drive the control lines into an unpowered chip. */
+  SP0256_CTRL &= ~(SP0256_ENABLE | SP0256_ALD | SP0256_RESET);
+  powered = false;
+  off_pending = false;
+  timer_stop(TIMER_SP0256_IDLE);
+}
+
+/* TIMER_SP0256_IDLE: nothing said for a while. */
+static void
+sp0256_idle(void)
+{
+  if(!speaking) {
+    sp0256_power_off();
+  }
+}
+
+static void
+sp0256_load(allophone_t allophone)
 {
   /* Load allophone, holding ALD high. */
   /* FIXME adhoc shift here, abstract that too. */
   SP0256_DATA = (allophone & 0x3F) << 2;
   SP0256_CTRL |= SP0256_ALD;
 
-  // Take ALD low for at least 1.1us, overkill.
-  // _delay_ms(1);
+  /* Take ALD low for at least 1.1us. */
   SP0256_CTRL &= ~SP0256_ALD;
-  _delay_ms(1);
-  // _delay_loop_1(); FIXME 3 cycles per loop.
+  _delay_loop_1(SP0256_ALD_LOOPS);
   SP0256_CTRL |= SP0256_ALD;
+}
+
+/* Say the next queued allophone, if any. Interrupts must be off. */
+static void
+sp0256_feed(void)
+{
+  if(fifo_head != fifo_tail) {
+    sp0256_load(fifo[fifo_head]);
+    fifo_head = (fifo_head + 1) & FIFO_MASK;
+    speaking = true;
+  } else {
+    speaking = false;
+    if(off_pending) {
+      sp0256_power_off();
+    } else {
+      timer_start(TIMER_SP0256_IDLE, SP0256_IDLE_MS, 0, sp0256_idle);
+    }
+  }
+}
+
+void
+sp0256_isr(void)
+{
+  /* Pin changes happen on both edges; SBY rising means done. */
+  if(speaking && (SP0256_CTRL_IN & SP0256_SBY)) {
+    sp0256_feed();
+  }
+}
+
+/* **************************************** */
+
+void
+sp0256_turn_on(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    timer_stop(TIMER_SP0256_IDLE);
+    if(powered) {
+      /* Still on. Just keep it that way. */
+      off_pending = false;
+      return;
+    }
+  }
+
+  /* Turn the SP0256 on. ALD idles high: low is an address load. */
+  SP0256_CTRL |= SP0256_ENABLE | SP0256_ALD;
+  _delay_ms(SP0256_POWER_MS);
+
+  /* Reset must be held low for at least 100ns. */
+  SP0256_CTRL |= SP0256_RESET;
+  _delay_loop_1(SP0256_RESET_LOOPS);
+  SP0256_CTRL &= ~SP0256_RESET;
+  _delay_loop_1(SP0256_RESET_LOOPS);
+  SP0256_CTRL |= SP0256_RESET;
+
+  powered = true;
+}
+
+void
+sp0256_turn_off(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(speaking) {
+      off_pending = true;
+    } else {
+      sp0256_power_off();
+    }
+  }
+}
+
+void
+sp0256_cancel(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    fifo_head = fifo_tail;
+    speaking = false;
+    sp0256_power_off();
+  }
+}
+
+bool
+sp0256_busy(void)
+{
+  return speaking;
+}
+
+void
+speak_allophone(allophone_t allophone)
+{
+  sp0256_turn_on();
+
+  while(1) {
+    bool queued = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      uint8_t next = (fifo_tail + 1) & FIFO_MASK;
+
+      if(next != fifo_head) {
+        fifo[fifo_tail] = allophone;
+        fifo_tail = next;
+        if(!speaking) {
+          sp0256_feed();
+        }
+        queued = true;
+      }
+    }
+
+    if(queued) {
+      return;
+    }
 
-  // Wait for the chip to finish.
-  // FIXME an interrupt might be the go here.
-  while(! (SP0256_CTRL_IN & SP0256_SBY)) {
+    /* Full: wait for the chip to finish an allophone. */
+    if(SREG & _BV(SREG_I)) {
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      cli();
+      if(((fifo_tail + 1) & FIFO_MASK) == fifo_head) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+      }
+      sei();
+    } else {
+      sp0256_isr();
+    }
   }
 }
@@ -8,12 +8,15 @@
 #ifndef _SP0256_H_
 #define _SP0256_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <util/delay.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 
+#include "allophones.h"
+
 /* **************************************** */
 /* Port connections. */
 
@@ -30,28 +33,61 @@
 #define SP0256_DATA_DDR DDRD
 
 /* **************************************** */
+/* Strobe timing. */
 
-static inline void
-sp0256_turn_on(void)
-{
-  /* Turn the SP0256 on. */
-  SP0256_CTRL |= SP0256_ENABLE;
-  _delay_ms(1);
-
-  /* Reset must be held low for at least 100ns, here 1ms, overkill. */
-  PORTB |= SP0256_RESET;
-  _delay_ms(1);
-  PORTB &= ~SP0256_RESET;
-  _delay_ms(1);
-  // _delay_loop_1(); FIXME 3 cycles per loop.
-  PORTB |= SP0256_RESET;
-}
+/* Minimum pulse widths from the datasheet, in nanoseconds. */
+#define SP0256_ALD_NS   1100
+#define SP0256_RESET_NS 100
 
-static inline void
-sp0256_turn_off(void)
-{
-  SP0256_CTRL &= ~SP0256_ENABLE;
-}
+/* Time for the supply to settle after enabling the chip. */
+#define SP0256_POWER_MS 1
+
+/*
+ * _delay_loop_1() iterations covering at least ns nanoseconds at
+ * F_CPU: round the cycle count up, three cycles per iteration. The
+ * port writes either side add a couple more cycles of slack.
+ */
+#define SP0256_CYCLES(ns) (((ns) * (F_CPU / 1000UL) + 999999UL) / 1000000UL)
+#define SP0256_LOOPS(ns)  ((SP0256_CYCLES(ns) + 2) / 3 ? (SP0256_CYCLES(ns) + 2) / 3 : 1)
+
+#define SP0256_ALD_LOOPS   SP0256_LOOPS(SP0256_ALD_NS)
+#define SP0256_RESET_LOOPS SP0256_LOOPS(SP0256_RESET_NS)
+
+/* **************************************** */
+
+/* Allophones waiting to be spoken, must be a power of two. */
+#ifndef SP0256_FIFO_LEN
+#define SP0256_FIFO_LEN 64
+#endif
+
+/*
+ * The chip is powered up by the first allophone spoken and stays on
+ * until it has been quiet for this many milliseconds (TIMER_SP0256_IDLE),
+ * so back-to-back announcements don't pay for a reset each.
+ */
+#ifndef SP0256_IDLE_MS
+#define SP0256_IDLE_MS 10000UL
+#endif
+
+/* Power up and reset the chip, unless it is already on. */
+void sp0256_turn_on(void);
+
+/* Power down, once everything queued has been said. */
+void sp0256_turn_off(void);
+
+/* Forget everything queued and power down now, mid-allophone if need
+   be. */
+void sp0256_cancel(void);
+
+/* Queue an allophone and return, unless the queue is full. Turns the
+   chip on if need be. */
+void speak_allophone(allophone_t allophone);
+
+/* Is there anything queued or being said? */
+bool sp0256_busy(void);
+
+/* Call from the pin change handler: SBY changed. */
+void sp0256_isr(void);
 
 static inline void
 sp0256_init(void)
@@ -69,6 +105,10 @@ sp0256_init(void)
   SP0256_CTRL = 0x0;
   SP0256_CTRL_DDR &= SP0256_SBY;
   SP0256_CTRL_DDR |= SP0256_ALD | SP0256_RESET | SP0256_ENABLE;
+
+  /* SBY rises when the chip finishes an allophone - PCINT6 - PCI0. */
+  PCMSK0 |= _BV(PCINT6);
+  PCICR |= _BV(PCIE0);
 }
 
 #endif /* _SP0256_H_ */
@@ -0,0 +1,19 @@
+/*
+ * Compile-time checks on what the preprocessor can't see, such as the
+ * number of members in an enum.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _STATIC_ASSERT_H_
+#define _STATIC_ASSERT_H_
+
+/* C99 has no _Static_assert, but an array can't have a negative size.
+   At most one per line. */
+#define STATIC_ASSERT(cond) STATIC_ASSERT_AT(cond, __LINE__)
+#define STATIC_ASSERT_AT(cond, line) STATIC_ASSERT_AT_(cond, line)
+#define STATIC_ASSERT_AT_(cond, line) \
+  typedef char static_assert_ ## line[(cond) ? 1 : -1]
+
+#endif /* _STATIC_ASSERT_H_ */
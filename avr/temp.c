@@ -1,73 +1,318 @@
+/*
+ * DS18B20 thermometer, read without waiting around.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+#include "crc8.h"
 #include "ds18x20.h"
 // FIXME abstract from 1-wire.
 #include "onewire.h"
 
-// FIXME maximum number of ds18x20 sensors.
-#define MAXSENSORS 1
-uint8_t gSensorIDs[MAXSENSORS][OW_ROMCODE_SIZE];
+#include "temp.h"
+#include "timers.h"
+
+/* **************************************** */
+
+#if TEMP_SENSORS_MAX > 8
+#error "The valid readings mask has room for 8 sensors"
+#endif
+
+static uint8_t ids[TEMP_SENSORS_MAX][OW_ROMCODE_SIZE];
+static uint8_t count;
+
+struct temp_rom_cache_t {
+  uint8_t magic;
+  uint8_t count;
+  uint8_t ids[TEMP_SENSORS_MAX][OW_ROMCODE_SIZE];
+};
 
-static
-uint8_t search_sensors(void)
+/* EEMEM goes on the object: on the type it is ignored, and this would
+   land in SRAM. */
+static struct temp_rom_cache_t rom_cache EEMEM;
+
+static uint8_t power;
+static bool converting;
+static uint16_t tconv = DS18B20_TCONV_12BIT;  /* The slowest sensor, ms. */
+
+static uint8_t valid;         /* Bitmask by sensor. */
+static int16_t readings[TEMP_SENSORS_MAX];
+
+/* **************************************** */
+
+static bool
+is_thermometer(uint8_t id[OW_ROMCODE_SIZE])
 {
-  uint8_t id[OW_ROMCODE_SIZE];
-  uint8_t diff, nSensors;
+  return crc8(id, OW_ROMCODE_SIZE) == 0
+    && (id[0] == DS18B20_FAMILY_CODE
+        || id[0] == DS18S20_FAMILY_CODE
+        || id[0] == DS1822_FAMILY_CODE);
+}
 
-  ow_reset();
+static uint8_t
+search_sensors(void)
+{
+  uint8_t id[OW_ROMCODE_SIZE];
+  uint8_t diff, n;
 
-  nSensors = 0;
+  n = 0;
 
   diff = OW_SEARCH_FIRST;
-  while( diff != OW_LAST_DEVICE && nSensors < MAXSENSORS) {
-    DS18X20_find_sensor(&diff, id);
+  while(diff != OW_LAST_DEVICE && n < TEMP_SENSORS_MAX) {
+    diff = ow_rom_search(diff, id);
 
-    if( diff == OW_PRESENCE_ERR ) {
-      speak(no);
-      speak(clown);
+    if(diff == OW_PRESENCE_ERR || diff == OW_DATA_ERR) {
       break;
     }
 
-    if( diff == OW_DATA_ERR ) {
-      speak(clown);
-      break;
+    /* Other devices may share the bus. */
+    if(is_thermometer(id)) {
+      for(uint8_t i = 0; i < OW_ROMCODE_SIZE; i++) {
+        ids[n][i] = id[i];
+      }
+      n++;
+    }
+  }
+
+  return n;
+}
+
+/* How long a sensor takes at the resolution in its scratchpad. */
+static uint16_t
+conversion_ms(const uint8_t *id, const uint8_t *sp)
+{
+  if(id[0] == DS18S20_FAMILY_CODE) {
+    return DS18S20_TCONV;
+  }
+
+  switch(sp[DS18B20_CONF_REG] & DS18B20_RES_MASK) {
+  case DS18B20_9_BIT:
+    return DS18B20_TCONV_9BIT;
+  case DS18B20_10_BIT:
+    return DS18B20_TCONV_10BIT;
+  case DS18B20_11_BIT:
+    return DS18B20_TCONV_11BIT;
+  default:
+    return DS18B20_TCONV_12BIT;
+  }
+}
+
+/* Ask every sensor how it's set up. False if one doesn't answer. */
+static bool
+read_config(void)
+{
+  uint8_t sp[DS18X20_SP_SIZE];
+
+  tconv = 0;
+  for(uint8_t i = 0; i < count; i++) {
+    uint16_t ms;
+
+    if(DS18X20_read_scratchpad(ids[i], sp, DS18X20_SP_SIZE) != DS18X20_OK) {
+      tconv = DS18B20_TCONV_12BIT;
+      return false;
     }
 
-    for(uint8_t i = 0; i < OW_ROMCODE_SIZE; i++) {
-      gSensorIDs[nSensors][i] = id[i];
+    ms = conversion_ms(ids[i], sp);
+    if(ms > tconv) {
+      tconv = ms;
     }
+  }
 
-    nSensors++;
+  return true;
+}
+
+/* Use the ROM codes from last time if they all still answer. */
+static bool
+load_cache(void)
+{
+  if(eeprom_read_byte(&rom_cache.magic) != TEMP_EEPROM_MAGIC) {
+    return false;
+  }
+
+  count = eeprom_read_byte(&rom_cache.count);
+  if(count == 0 || count > TEMP_SENSORS_MAX) {
+    count = 0;
+    return false;
   }
 
-  return nSensors;
+  eeprom_read_block(ids, rom_cache.ids, count * OW_ROMCODE_SIZE);
+
+  for(uint8_t i = 0; i < count; i++) {
+    if(!is_thermometer(ids[i])) {
+      count = 0;
+      return false;
+    }
+  }
+
+  if(!read_config()) {
+    count = 0;
+    return false;
+  }
+
+  return true;
 }
 
-static
-void ds18x20_init(void)
+static void
+save_cache(void)
 {
-  uint8_t nSensors = search_sensors();
-  speak_number(nSensors);
-  speak(sensors);
+  eeprom_update_block(ids, rom_cache.ids, count * OW_ROMCODE_SIZE);
+  eeprom_update_byte(&rom_cache.count, count);
+  eeprom_update_byte(&rom_cache.magic, TEMP_EEPROM_MAGIC);
 }
 
-static
-void ds18x20_read(void)
+/* **************************************** */
+
+bool
+temp_init(void)
 {
-  // range from -550:-55.0°C to 1250:+125.0°C -> min. 6+1 chars
-  int16_t decicelsius;
+  if(load_cache()) {
+    power = DS18X20_get_power_status(NULL);
+    return true;
+  }
 
-  DS18X20_start_meas(DS18X20_POWER_PARASITE, NULL);
-  _delay_ms(DS18B20_TCONV_12BIT);
-  DS18X20_read_decicelsius_single(gSensorIDs[0][0], &decicelsius);  // family-code for conversion-routine
+  return temp_search();
+}
 
-  int8_t d = decicelsius / 10;
-  uint8_t r = decicelsius % 10;
+bool
+temp_search(void)
+{
+  if(converting) {
+    return false;
+  }
 
-  speak(it);
-  speak(is);
-  speak_number(d);
-  if(r > 0) {
-    speak(point);
-    speak_number(r);
+  valid = 0;
+  count = search_sensors();
+  if(count == 0) {
+    return false;
   }
-  speak(degrees);
+
+  save_cache();
+
+  /* Any parasite-powered sensor answers for everyone, see the datasheet. */
+  power = DS18X20_get_power_status(NULL);
+
+  if(!temp_set_precision(TEMP_PRECISION_DEFAULT)) {
+    read_config();
+  }
+
+  return true;
+}
+
+uint8_t
+temp_count(void)
+{
+  return count;
+}
+
+bool
+temp_set_precision(uint16_t precision)
+{
+  uint8_t sp[DS18X20_SP_SIZE];
+  uint8_t res = 0;
+  bool ok = true;
+
+  if(count == 0 || converting) {
+    return false;
+  }
+
+  /* 0 is 9 bits, 3 is 12. */
+  while(res < 3 && (DS18X20_FRACCONV << (3 - res)) > precision) {
+    res++;
+  }
+
+  for(uint8_t i = 0; i < count; i++) {
+    if(ids[i][0] == DS18S20_FAMILY_CODE) {
+      continue;
+    }
+
+    if(DS18X20_read_scratchpad(ids[i], sp, DS18X20_SP_SIZE) != DS18X20_OK) {
+      ok = false;
+      continue;
+    }
+
+    /* Spare the sensor's EEPROM. */
+    if((sp[DS18B20_CONF_REG] & DS18B20_RES_MASK) == (res << 5)) {
+      continue;
+    }
+
+    /* Keep the alarm thresholds. The copy to EEPROM takes 10ms, spun
+       out in DS18X20_scratchpad_to_eeprom(), but this is rare. */
+    if(DS18X20_write_scratchpad(ids[i], sp[DS18X20_TH_REG], sp[DS18X20_TL_REG], res << 5) != DS18X20_OK
+       || DS18X20_scratchpad_to_eeprom(power, ids[i]) != DS18X20_OK) {
+      ok = false;
+    }
+  }
+
+  return read_config() && ok;
+}
+
+bool
+temp_start(void)
+{
+  if(count == 0) {
+    return false;
+  }
+
+  if(converting) {
+    /* The readings on their way will do. */
+    return true;
+  }
+
+  /* SKIP_ROM: everyone converts together. */
+  if(DS18X20_start_meas(power, NULL) != DS18X20_OK) {
+    return false;
+  }
+
+  converting = true;
+  timer_start(TIMER_TEMP, TEMP_MARGIN(tconv), 0, NULL);
+
+  return true;
+}
+
+bool
+temp_timer(void)
+{
+  if(!converting) {
+    return false;
+  }
+
+  if(power == DS18X20_POWER_EXTERN) {
+    if(DS18X20_conversion_in_progress() == DS18X20_CONVERTING) {
+      timer_start(TIMER_TEMP, TEMP_RETRY_MS, 0, NULL);
+      return false;
+    }
+  } else {
+    ow_parasite_disable();
+  }
+
+  converting = false;
+  valid = 0;
+
+  /* MATCH_ROM, and the scratchpad's CRC is checked. */
+  for(uint8_t i = 0; i < count; i++) {
+    if(DS18X20_read_decicelsius(ids[i], &readings[i]) == DS18X20_OK
+       && readings[i] != DS18X20_INVALID_DECICELSIUS) {
+      valid |= _BV(i);
+    }
+  }
+
+  return true;
+}
+
+bool
+temp_get(uint8_t sensor, int16_t *decicelsius)
+{
+  if(sensor >= count || !(valid & _BV(sensor))) {
+    return false;
+  }
+
+  *decicelsius = readings[sensor];
+  return true;
 }
@@ -0,0 +1,90 @@
+/*
+ * DS18B20 thermometer, read without waiting around.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _TEMP_H_
+#define _TEMP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ds18x20.h"
+
+/* **************************************** */
+
+/*
+ * A conversion takes from 94ms at 9 bits to 750ms at 12 bits. Rather
+ * than spin for that long, temp_start() kicks it off and sets
+ * TIMER_TEMP for the slowest sensor, and we sleep until it expires.
+ * The WDT is only good to a few percent (see timers.h), hence the
+ * margin of TEMP_MARGIN(). With the square wave time base the deadline
+ * is rounded up to the next second.
+ *
+ * All the sensors on the bus convert at once, so this happens once
+ * however many there are. Each is then read by its ROM code, with the
+ * scratchpad's CRC checked.
+ *
+ * A parasite-powered sensor needs the strong pull-up for the whole
+ * conversion and can't tell us when it's finished, so the deadline is
+ * all we have. One with its own supply answers read slots with 0
+ * until it's done; if it is still busy at the deadline we try again
+ * TEMP_RETRY_MS later. If any sensor is parasite-powered they are all
+ * treated that way.
+ */
+#define TEMP_MARGIN(ms) ((ms) + (ms) / 8)
+#define TEMP_RETRY_MS 16
+
+/*
+ * Precision is in ten-thousandths of a degree, like
+ * DS18X20_FRACCONV: a DS18B20 resolves 5000 (0.5 degrees) at 9 bits,
+ * halving with each extra bit down to 625 at 12. Each bit doubles the
+ * conversion time, so we use the fewest that will do. Speech only
+ * needs half a degree.
+ *
+ * The DS18S20 is always 9 bits and 750ms, and is left alone.
+ */
+#define TEMP_PRECISION_DEFAULT 5000
+
+/* Sensors we keep track of, no more than 8. */
+#define TEMP_SENSORS_MAX 4
+
+/*
+ * The ROM codes found by the last search are kept in the AVR's
+ * EEPROM: they never change, so there is no wear to speak of, and they
+ * survive the RTC battery going flat. On a cold boot each cached
+ * sensor is asked for its scratchpad; if any fails to answer with a
+ * good CRC the bus is searched again. Newly found sensors are set to
+ * TEMP_PRECISION_DEFAULT.
+ */
+#define TEMP_EEPROM_MAGIC 0x18
+
+/* Find the sensors on the 1-wire bus, from the cache if possible. */
+bool temp_init(void);
+
+/* Search the bus again, ignoring the cache. */
+bool temp_search(void);
+
+/* How many sensors we found. */
+uint8_t temp_count(void);
+
+/* Set every sensor to the coarsest resolution at least as fine as
+   precision, and have them keep it in their EEPROM. Sensors already
+   there are not written to. */
+bool temp_set_precision(uint16_t precision);
+
+/* Start a conversion on every sensor. The results show up as a
+   temperature_event for the controller. Fails if there is no sensor
+   or the bus is shorted. */
+bool temp_start(void);
+
+/* TIMER_TEMP expired. True if the controller should be told. */
+bool temp_timer(void);
+
+/* The last reading of a sensor, in tenths of a degree Celsius. False
+   if it failed. */
+bool temp_get(uint8_t sensor, int16_t *decicelsius);
+
+#endif /* _TEMP_H_ */
@@ -0,0 +1,240 @@
+/*
+ * What wakes us up to keep time: the watch-dog timer or the DS1307's
+ * 1Hz square wave.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/power.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#include "ds1307.h"
+#include "timebase.h"
+#include "timers.h"
+#include "uart.h"
+
+/* **************************************** */
+
+/* WDT periods are 16ms << n for n in 0..9. */
+#define WDT_MIN_MS 16U
+#define WDT_MAX_N  9
+
+/* The DS1307 switches SQW on the second, falling edge first. */
+#define SQW_MS 1000U
+
+#if TIMEBASE_FINE_COUNTS < 1 || TIMEBASE_FINE_COUNTS > 256
+#error "Timer2 can't tick every 16ms or so at this F_CPU"
+#endif
+
+static volatile timebase_t current = TIMEBASE_WDT;
+
+/* Interrupt, do not reset the system. Timed sequence. */
+static inline void
+wdt_program(uint8_t n)
+{
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | (n & 0x7) | ((n & 0x8) ? _BV(WDP3) : 0);
+}
+
+static inline void
+wdt_stop(void)
+{
+  wdt_reset();
+  MCUSR &= ~_BV(WDRF);
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = 0;
+}
+
+/* **************************************** */
+
+uint16_t
+timebase_program(uint32_t delta)
+{
+  uint8_t n = 0;
+
+  if(current == TIMEBASE_SQW) {
+    return SQW_MS;
+  }
+
+  /* The longest period no longer than delta. */
+  while(n < WDT_MAX_N && ((uint32_t)WDT_MIN_MS << (n + 1)) <= delta) {
+    n++;
+  }
+
+  wdt_program(n);
+
+  return WDT_MIN_MS << n;
+}
+
+bool
+timebase_select(timebase_t tb)
+{
+  if(tb == TIMEBASE_SQW) {
+    if(!ds1307_sqw(true)) {
+      return false;
+    }
+    PORTC |= TIMEBASE_SQW_PIN;
+    PCMSK1 |= _BV(PCINT10);
+    PCICR |= _BV(PCIE1);
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    current = tb;
+    if(tb == TIMEBASE_SQW) {
+      wdt_stop();
+    }
+    timers_reschedule();
+  }
+
+  if(tb == TIMEBASE_WDT) {
+    /* PCIE1 stays: the accelerometer uses it too. */
+    PCMSK1 &= ~_BV(PCINT10);
+    PORTC &= ~TIMEBASE_SQW_PIN;
+    ds1307_sqw(false);
+  }
+
+  return true;
+}
+
+timebase_t
+timebase_current(void)
+{
+  return current;
+}
+
+void
+timebase_sqw_isr(void)
+{
+  if(current == TIMEBASE_SQW && !(TIMEBASE_SQW_IN & TIMEBASE_SQW_PIN)) {
+    timers_isr();
+  }
+}
+
+/* **************************************** */
+
+/* Timer2 compare match, the fine clock ticked. */
+ISR(TIMER2_COMPA_vect)
+{
+  timers_fine_isr();
+}
+
+void
+timebase_fine_start(void)
+{
+  power_timer2_enable();
+  TCCR2B = 0;
+  TCCR2A = _BV(WGM21);
+  TCNT2 = 0;
+  OCR2A = TIMEBASE_FINE_COUNTS - 1;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+  /* clk/1024. */
+  TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+}
+
+void
+timebase_fine_stop(void)
+{
+  TCCR2B = 0;
+  TIMSK2 = 0;
+  power_timer2_disable();
+}
+
+bool
+timebase_fine_running(void)
+{
+  return TCCR2B != 0;
+}
+
+uint16_t
+timebase_fine_partial_us(void)
+{
+  /* TIMEBASE_FINE_US is a whole number of counts. */
+  uint16_t us = (uint32_t)TCNT2 * TIMEBASE_FINE_US / TIMEBASE_FINE_COUNTS;
+
+  if(TIFR2 & _BV(OCF2A)) {
+    us += TIMEBASE_FINE_US;
+  }
+
+  return us;
+}
+
+/* **************************************** */
+
+#ifdef TIMEBASE_BENCH
+
+/* Timer1 at clk/64: 64us per count at 1MHz. */
+#define BENCH_PRESCALE 64
+
+static uint16_t wakeups;
+static volatile uint32_t awake_counts;
+static uint32_t bench_start;
+
+ISR(TIMER1_OVF_vect)
+{
+  awake_counts += 0x10000UL;
+}
+
+void
+timebase_bench_wake(void)
+{
+  wakeups++;
+
+  power_timer1_enable();
+  TCCR1A = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TIMSK1 = _BV(TOIE1);
+  TCCR1B = _BV(CS11) | _BV(CS10);
+}
+
+void
+timebase_bench_sleep(void)
+{
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    awake_counts += TCNT1;
+  }
+  power_timer1_disable();
+}
+
+void
+timebase_bench_report(void)
+{
+  uint32_t now = timers_now();
+  uint32_t counts, awake_ms;
+
+  if(now - bench_start < TIMEBASE_BENCH_MS) {
+    return;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    counts = awake_counts;
+    awake_counts = 0;
+  }
+
+  /* F_CPU / BENCH_PRESCALE isn't a whole number of counts per ms. */
+  awake_ms = (uint64_t)counts * BENCH_PRESCALE / (F_CPU / 1000UL);
+
+  uart_putstringP(current == TIMEBASE_SQW ? PSTR("bench sqw") : PSTR("bench wdt"), false);
+  uart_putstringP(PSTR(" wakeups "), false);
+  uart_putw_dec(wakeups);
+  uart_putstringP(PSTR(" awake ms "), false);
+  uart_putl_dec(awake_ms);
+  uart_tx_nl();
+
+  wakeups = 0;
+  bench_start = now;
+}
+
+#endif /* TIMEBASE_BENCH */
@@ -0,0 +1,105 @@
+/*
+ * What wakes us up to keep time: the watch-dog timer or the DS1307's
+ * 1Hz square wave.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+
+/* **************************************** */
+
+/*
+ * The WDT wakes us only when a timer is due, but its oscillator is
+ * poor (see clock.h). The DS1307's square wave is crystal-accurate but
+ * wakes us every second, and the SQW pin needs a pull-up, which we
+ * provide with the AVR's internal one while it is in use.
+ */
+typedef enum {
+  TIMEBASE_WDT,
+  TIMEBASE_SQW
+} timebase_t;
+
+#ifndef TIMEBASE_DEFAULT
+#define TIMEBASE_DEFAULT TIMEBASE_WDT
+#endif
+
+/* 1Hz tick from the RTC - PC2 - PCINT10 - PCI1. */
+#define TIMEBASE_SQW_PIN (_BV(PC2))
+#define TIMEBASE_SQW_IN  PINC
+
+/* Switch time base. The SQW needs the DS1307, so false if we can't
+   talk to it; the WDT carries on. */
+bool timebase_select(timebase_t tb);
+timebase_t timebase_current(void);
+
+/* For timers.c: arrange an interrupt about delta milliseconds from
+   now, or sooner. Returns how many milliseconds it will be.
+   Interrupts must be off. */
+uint16_t timebase_program(uint32_t delta);
+
+/* Call from the PCINT1 handler when the SQW pin changes. */
+void timebase_sqw_isr(void);
+
+/*
+ * A timer started between time base interrupts can't be scheduled on
+ * the WDT without restarting it, and the part of the period that has
+ * already gone by would be lost. Instead it is timed with Timer2 until
+ * the next interrupt, by which point we know where we are. Timer2
+ * only runs while we're awake or in idle sleep.
+ *
+ * It interrupts every TIMEBASE_FINE_US microseconds, about 16ms,
+ * rounded down so deadlines are never early.
+ */
+#define TIMEBASE_FINE_PRESCALE 1024
+#define TIMEBASE_FINE_COUNTS   (F_CPU / TIMEBASE_FINE_PRESCALE / 64)
+#define TIMEBASE_FINE_US       ((uint32_t)((uint64_t)TIMEBASE_FINE_COUNTS * TIMEBASE_FINE_PRESCALE * 1000000UL / F_CPU))
+
+/* For timers.c: start Timer2 from zero, calling timers_fine_isr() on
+   each tick, and stop it. Interrupts must be off. */
+void timebase_fine_start(void);
+void timebase_fine_stop(void);
+
+/* Is Timer2 running? Then we mustn't power down. */
+bool timebase_fine_running(void);
+
+/* How far into its current tick Timer2 is, in microseconds, counting
+   one that's pending. Interrupts must be off. */
+uint16_t timebase_fine_partial_us(void);
+
+/* **************************************** */
+
+/*
+ * Benchmarking: count wakeups and time spent awake (using Timer1,
+ * which stops in power-down) and report them every hour over the
+ * serial port, so the two time bases can be compared on real
+ * hardware. Costs a timer and some current, so only if asked for.
+ */
+
+#ifdef TIMEBASE_BENCH
+
+#define TIMEBASE_BENCH_MS 3600000UL
+
+/* Call just after waking up and just before going to sleep. */
+void timebase_bench_wake(void);
+void timebase_bench_sleep(void);
+
+/* Print and restart the figures if an hour has gone by. */
+void timebase_bench_report(void);
+
+#else
+
+static inline void timebase_bench_wake(void) {}
+static inline void timebase_bench_sleep(void) {}
+static inline void timebase_bench_report(void) {}
+
+#endif /* TIMEBASE_BENCH */
+
+#endif /* _TIMEBASE_H_ */
@@ -0,0 +1,257 @@
+/*
+ * Software timers on the watch-dog timer, or whatever timebase.h says.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "events.h"
+#include "static_assert.h"
+#include "timebase.h"
+#include "timers.h"
+
+/* **************************************** */
+
+/* timers_expired() has room for 8. */
+STATIC_ASSERT(TIMERS <= 8);
+
+/* How late each may fire, in milliseconds, if that saves running
+   Timer2. */
+static const uint16_t slack_ms[TIMERS] PROGMEM = {
+  [TIMER_HOUSEKEEPING] = TIMER_HOUSEKEEPING_MS,
+  [TIMER_SP0256_IDLE] = UINT16_MAX,  /* Costs only power. */
+  [TIMER_TEMP] = 1000,               /* Someone may be waiting. */
+  [TIMER_UART_IDLE] = 0,             /* We sleep lightly till then. */
+  [TIMER_FRAME] = 0
+};
+
+struct timer_t {
+  uint32_t deadline;  /* By now, or by fine_us if fine. */
+  uint32_t period;
+  timer_callback_t cb;
+  bool armed;
+  bool fine;
+};
+
+static struct timer_t timers[TIMERS];
+static volatile uint8_t expired;
+
+static volatile uint32_t now;
+static uint16_t tick_ms;      /* Until the next time base interrupt. */
+static uint8_t epoch;
+
+/* We're in timers_isr(), or haven't started: it's the start of a
+   period. */
+static bool at_tick = true;
+
+/* Microseconds since Timer2 was started, as of its last interrupt. */
+static uint32_t fine_us;
+
+/* **************************************** */
+
+/* Is a before b? Wrap-around safe. */
+static inline bool
+before(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) < 0;
+}
+
+/* Sleep until the earliest deadline. Interrupts must be off. */
+static void
+schedule(void)
+{
+  uint32_t delta = UINT32_MAX;
+
+  for(uint8_t i = 0; i < TIMERS; i++) {
+    if(timers[i].armed && !timers[i].fine) {
+      uint32_t d = before(now, timers[i].deadline) ? timers[i].deadline - now : 0;
+
+      if(d < delta) {
+        delta = d;
+      }
+    }
+  }
+
+  tick_ms = timebase_program(delta);
+}
+
+/* Fire the timers due by t, on the clock given by fine. Interrupt
+   handlers only. */
+static void
+fire(bool fine, uint32_t t)
+{
+  bool post = false;
+
+  for(uint8_t i = 0; i < TIMERS; i++) {
+    struct timer_t *tm = &timers[i];
+
+    if(tm->armed && tm->fine == fine && !before(t, tm->deadline)) {
+      if(tm->period) {
+        uint32_t period = fine ? tm->period * 1000 : tm->period;
+
+        tm->deadline += period;
+        /* Don't try to catch up on missed periods. */
+        if(!before(t, tm->deadline)) {
+          tm->deadline = t + period;
+        }
+      } else {
+        tm->armed = false;
+      }
+
+      if(tm->cb) {
+        tm->cb();
+      } else {
+        expired |= _BV(i);
+        post = true;
+      }
+    }
+  }
+
+  if(post) {
+    events_push(EVENT_TIMER);
+  }
+}
+
+/* **************************************** */
+
+void
+timers_init(void)
+{
+  now = 0;
+  schedule();
+  at_tick = false;
+}
+
+void
+timers_reschedule(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    epoch++;
+    schedule();
+  }
+}
+
+uint32_t
+timers_now(void)
+{
+  uint32_t t;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t = now;
+  }
+
+  return t;
+}
+
+uint8_t
+timers_epoch(void)
+{
+  return epoch;
+}
+
+void
+timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    struct timer_t *t = &timers[id];
+
+    t->period = period;
+    t->cb = cb;
+    t->armed = true;
+
+    if(at_tick) {
+      /* timers_isr() will schedule it. */
+      t->fine = false;
+      t->deadline = now + ms;
+    } else if(tick_ms <= pgm_read_word(&slack_ms[id])) {
+      /* Count from the end of this period: late by what's left of it. */
+      t->fine = false;
+      t->deadline = now + tick_ms + ms;
+    } else {
+      /* We don't know how far into the period we are. */
+      uint32_t fine_now = 0;
+
+      if(timebase_fine_running()) {
+        fine_now = fine_us + timebase_fine_partial_us();
+      } else {
+        fine_us = 0;
+        timebase_fine_start();
+      }
+      t->fine = true;
+      t->deadline = fine_now + ms * 1000;
+    }
+  }
+}
+
+void
+timer_stop(timer_id_t id)
+{
+  /* The time base will fire as planned and find nothing to do. */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    timers[id].armed = false;
+  }
+}
+
+uint8_t
+timers_expired(void)
+{
+  uint8_t e;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    e = expired;
+    expired = 0;
+  }
+
+  return e;
+}
+
+void
+timers_isr(void)
+{
+  at_tick = true;
+  now += tick_ms;
+
+  /* Now we know where we are, hand Timer2's timers back to the time
+     base, rounding up. */
+  if(timebase_fine_running()) {
+    uint32_t fine_now = fine_us + timebase_fine_partial_us();
+
+    for(uint8_t i = 0; i < TIMERS; i++) {
+      struct timer_t *t = &timers[i];
+
+      if(t->armed && t->fine) {
+        uint32_t us = before(fine_now, t->deadline) ? t->deadline - fine_now : 0;
+
+        t->deadline = now + (us + 999) / 1000;
+        t->fine = false;
+      }
+    }
+    timebase_fine_stop();
+  }
+
+  fire(false, now);
+  schedule();
+  at_tick = false;
+}
+
+void
+timers_fine_isr(void)
+{
+  bool running = false;
+
+  fine_us += TIMEBASE_FINE_US;
+  fire(true, fine_us);
+
+  for(uint8_t i = 0; i < TIMERS; i++) {
+    running = running || (timers[i].armed && timers[i].fine);
+  }
+  if(!running) {
+    timebase_fine_stop();
+  }
+}
@@ -0,0 +1,85 @@
+/*
+ * Software timers on the watch-dog timer, or whatever timebase.h says.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _TIMERS_H_
+#define _TIMERS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* **************************************** */
+
+/*
+ * The WDT is reprogrammed at each expiry to wake us at the next
+ * deadline, using the longest prescaler period (16ms to 8s) that
+ * doesn't overshoot it. So deadlines are met to within 16ms, and
+ * nothing wakes us more often than the timers need. With the DS1307
+ * square wave as the time base we wake every second instead, see
+ * timebase.h.
+ *
+ * The WDT is only ever reprogrammed as it expires, so no time is lost.
+ * We don't know how far into the period a timer started in between
+ * is. If it can be late by a whole period (its slack, in timers.c),
+ * it is counted from the next expiry. Otherwise it runs on Timer2
+ * until then, see timebase.h. Switching time base does restart the
+ * WDT, and the part of the period that had gone by is lost;
+ * timers_epoch() counts these.
+ *
+ * Time is nominal: the WDT oscillator is only good to a few percent.
+ */
+
+typedef enum {
+  TIMER_HOUSEKEEPING,   /* Alarms and so forth, every TIMER_HOUSEKEEPING_MS. */
+  TIMER_SP0256_IDLE,    /* Switch the SP0256 off, see sp0256.h. */
+  TIMER_TEMP,           /* A temperature conversion is done, see temp.h. */
+  TIMER_UART_IDLE,      /* Nothing received for TIMER_UART_IDLE_MS. */
+  TIMER_FRAME,          /* A frame stalled part way, see frame.h. */
+  TIMERS
+} timer_id_t;
+
+#define TIMER_HOUSEKEEPING_MS 8192UL
+
+/* Give up on a half-received command or frame after this long. */
+#define TIMER_UART_IDLE_MS 8000UL
+
+/* Called from the time base's interrupt handler. */
+typedef void (*timer_callback_t)(void);
+
+/* Program the time base. Call with interrupts off. Timers started
+   before this are counted from here, on the time base rather than
+   Timer2. */
+void timers_init(void);
+
+/* The time base changed: work out when to wake up again. */
+void timers_reschedule(void);
+
+/* Milliseconds since timers_init(), as of the last time base
+   interrupt: it doesn't move in between. */
+uint32_t timers_now(void);
+
+/* Bumped each time the time base loses time. */
+uint8_t timers_epoch(void);
+
+/*
+ * Fire in ms milliseconds, then every period milliseconds if that's
+ * not zero. With no callback, expiry posts EVENT_TIMER and shows up in
+ * timers_expired(). Restarting a running timer moves it. Up to an hour.
+ */
+void timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb);
+void timer_stop(timer_id_t id);
+
+/* The timers without callbacks that have fired since last asked, as a
+   bitmask of _BV(timer_id_t). */
+uint8_t timers_expired(void);
+
+/* Call from the time base's interrupt handler. */
+void timers_isr(void);
+
+/* Call from Timer2's, see timebase.h. */
+void timers_fine_isr(void);
+
+#endif /* _TIMERS_H_ */
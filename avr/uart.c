@@ -34,6 +34,7 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 
 /* **************************************** */
 /* Primitive synchronous blocking read. */
@@ -49,44 +50,175 @@
 /* **************************************** */
 /* Interrupts and FIFO buffers, asynchronous non-blocking read/write. */
 
-#define RX_FIFO_LEN 8
-#define TX_FIFO_LEN 8
+#define RX_FIFO_MASK (UART_RX_FIFO_LEN - 1)
 
-static volatile uint8_t rx_fifo[RX_FIFO_LEN];
-static volatile uint8_t rx_fifo_head, rx_fifo_tail; /* implicitly initialized to 0 */
+#if UART_RX_FIFO_LEN & RX_FIFO_MASK
+#error "UART_RX_FIFO_LEN must be a power of two"
+#endif
 
-/* The UART completely received something. */
+/* Must be a power of two. */
+#define TX_FIFO_LEN 64
+#define TX_FIFO_MASK (TX_FIFO_LEN - 1)
 
-  /* FIXME ignore the issue of overflow. This is racey: Drop old data
-     when we overflow. Easiest to drop new data on the floor... but
-     last-data wins is probably nicer semantics. Maybe just flushing
-     on every overflow is not so bad either.
+#if TX_FIFO_LEN & TX_FIFO_MASK
+#error "TX_FIFO_LEN must be a power of two"
+#endif
 
-     I think this code does this last thing.
+static volatile uint8_t rx_fifo[UART_RX_FIFO_LEN];
+static volatile uint8_t rx_fifo_head, rx_fifo_tail; /* implicitly initialized to 0 */
 
-  */
+static volatile struct uart_stats_t stats;
 
+/* The UART completely received something. */
 ISR(USART_RX_vect)
 {
+  /* The error flags are only valid before UDR0 is read. */
+  uint8_t status = UCSR0A;
   /* Clears the RXC0 flag. */
-  rx_fifo[rx_fifo_tail] = UDR0;
-  rx_fifo_tail = (rx_fifo_tail + 1) % RX_FIFO_LEN;
+  uint8_t c = UDR0;
+  uint8_t next;
+
+  if(status & _BV(DOR0)) {
+    stats.rx_overrun++;
+  }
 
-  /* if(rx_fifo_tail == rx_fifo_head) { */
-  /*   rx_fifo_head = (rx_fifo_head + 1) % RX_FIFO_LEN; */
-  /* } */
+  if(status & _BV(FE0)) {
+    stats.rx_framing++;
+    return;
+  }
+
+  next = (rx_fifo_tail + 1) & RX_FIFO_MASK;
+  if(next == rx_fifo_head) {
+    stats.rx_dropped++;
+#if UART_RX_OVERFLOW == UART_RX_DROP_OLDEST
+    rx_fifo_head = (rx_fifo_head + 1) & RX_FIFO_MASK;
+#else
+    return;
+#endif
+  }
+
+  rx_fifo[rx_fifo_tail] = c;
+  rx_fifo_tail = next;
 }
 
-/* FIXME can't inline this as it depends on state + ISR. */
+/* FIXME can't inline this as it depends on state + ISR.
+ * Dropping the oldest character means the ISR moves the head too, so
+ * this has to be atomic. */
 bool
 uart_rx(uint8_t *v)
 {
-  if(rx_fifo_tail != rx_fifo_head) {
-    *v = rx_fifo[rx_fifo_head];
-    rx_fifo_head = (rx_fifo_head + 1) % RX_FIFO_LEN;
-    return true;
-  } else {
-    return false;
+  bool got = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(rx_fifo_tail != rx_fifo_head) {
+      *v = rx_fifo[rx_fifo_head];
+      rx_fifo_head = (rx_fifo_head + 1) & RX_FIFO_MASK;
+      got = true;
+    }
+  }
+
+  return got;
+}
+
+bool
+uart_rx_pending(void)
+{
+  return rx_fifo_tail != rx_fifo_head;
+}
+
+void
+uart_get_stats(struct uart_stats_t *s)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    s->rx_dropped = stats.rx_dropped;
+    s->rx_overrun = stats.rx_overrun;
+    s->rx_framing = stats.rx_framing;
+  }
+}
+
+/* **************************************** */
+
+static volatile uint8_t tx_fifo[TX_FIFO_LEN];
+static volatile uint8_t tx_fifo_head, tx_fifo_tail; /* implicitly initialized to 0 */
+
+/* Set when a character has been handed to the UART and we haven't yet
+   seen it leave the shift register. */
+static volatile bool tx_pending;
+
+/* Move the next queued character into the data register, which must be
+   empty. Disarm the interrupt when there's nothing left to send. */
+static inline void
+tx_fifo_send(void)
+{
+  if(tx_fifo_head != tx_fifo_tail) {
+    /* Clear TXC0 (by writing a 1) so uart_tx_flush() can see this character go. */
+    UCSR0A |= _BV(TXC0);
+    UDR0 = tx_fifo[tx_fifo_head];
+    tx_fifo_head = (tx_fifo_head + 1) & TX_FIFO_MASK;
+    tx_pending = true;
+  }
+
+  if(tx_fifo_head == tx_fifo_tail) {
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+/* The UART data register is empty. */
+ISR(USART_UDRE_vect)
+{
+  tx_fifo_send();
+}
+
+/* With interrupts off (in an ISR, or during initialisation) nobody
+   drains the FIFO, so do it by hand. */
+static inline void
+tx_fifo_poll(void)
+{
+  if(!(SREG & _BV(SREG_I)) && (UCSR0A & _BV(UDRE0))) {
+    tx_fifo_send();
+  }
+}
+
+/* Interrupt handlers also print debugging output, so enqueuing must be
+   atomic with respect to them. */
+bool
+uart_tx_nb(uint8_t c)
+{
+  bool queued = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t next = (tx_fifo_tail + 1) & TX_FIFO_MASK;
+
+    if(next != tx_fifo_head) {
+      tx_fifo[tx_fifo_tail] = c;
+      tx_fifo_tail = next;
+      UCSR0B |= _BV(UDRIE0);
+      queued = true;
+    }
+  }
+
+  return queued;
+}
+
+void
+uart_tx(uint8_t c)
+{
+  while(!uart_tx_nb(c)) {
+    tx_fifo_poll();
+  }
+}
+
+void
+uart_tx_flush(void)
+{
+  while(tx_fifo_head != tx_fifo_tail) {
+    tx_fifo_poll();
+  }
+
+  if(tx_pending) {
+    while(!(UCSR0A & _BV(TXC0)))
+      ;
+    tx_pending = false;
   }
 }
 
@@ -150,3 +282,43 @@ uart_putw_dec(uint16_t w)
     num /= 10;
   }
 }
+
+void
+uart_putsw_dec(int16_t w)
+{
+  if(w < 0) {
+    uart_tx('-');
+    uart_putw_dec(-(uint16_t)w);
+  } else {
+    uart_putw_dec(w);
+  }
+}
+
+void
+uart_putl_dec(uint32_t l)
+{
+  uint32_t num = 1000000000UL;
+  bool started = 0;
+
+  while(num > 0) {
+    uint8_t b = l / num;
+    if(b > 0 || started || num == 1) {
+      uart_tx('0' + b);
+      started = true;
+    }
+    l -= b * num;
+
+    num /= 10;
+  }
+}
+
+void
+uart_putsl_dec(int32_t l)
+{
+  if(l < 0) {
+    uart_tx('-');
+    uart_putl_dec(-(uint32_t)l);
+  } else {
+    uart_putl_dec(l);
+  }
+}
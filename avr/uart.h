@@ -28,9 +28,6 @@
  * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-
-FIXME add TX queue.
-
  */
 
 #ifndef _UART_H_
@@ -41,21 +38,52 @@ FIXME add TX queue.
 
 #include <avr/pgmspace.h>
 
+/* RX FIFO length, must be a power of two. */
+#ifndef UART_RX_FIFO_LEN
+#define UART_RX_FIFO_LEN 16
+#endif
+
+/* What to do with a character that arrives when the RX FIFO is full. */
+#define UART_RX_DROP_NEWEST 0
+#define UART_RX_DROP_OLDEST 1
+
+#ifndef UART_RX_OVERFLOW
+#define UART_RX_OVERFLOW UART_RX_DROP_NEWEST
+#endif
+
+/* Receive error counters. These wrap. */
+struct uart_stats_t {
+  uint16_t rx_dropped;  /* RX FIFO overflows. */
+  uint16_t rx_overrun;  /* Hardware data overruns (DOR0). */
+  uint16_t rx_framing;  /* Framing errors (FE0), character discarded. */
+};
+
+void uart_get_stats(struct uart_stats_t *stats);
+
 bool uart_rx(uint8_t *v);
 
-/* Inlining this should be cheap. */
-static inline void
-uart_tx(uint8_t c)
-{
-  while(! (UCSR0A & _BV(UDRE0)))
-      ;
-  UDR0 = c;
-}
+/* Is there anything in the RX FIFO? */
+bool uart_rx_pending(void);
+
+/* Queue a character for transmission. Returns false if the TX FIFO is
+   full. Never waits. */
+bool uart_tx_nb(uint8_t c);
+
+/* Queue a character for transmission, waiting for room in the TX FIFO
+   if necessary. */
+void uart_tx(uint8_t c);
+
+/* Wait until everything queued has left the shift register. Call this
+   before powering the USART down or going to sleep. */
+void uart_tx_flush(void);
 
 void uart_tx_nl(void);
 void uart_putstring(const char *str, bool nl);
 void uart_putstringP(const char *str, bool nl);
 void uart_putw_dec(uint16_t w);
+void uart_putsw_dec(int16_t w);
+void uart_putl_dec(uint32_t l);
+void uart_putsl_dec(int32_t l);
 
 /* FIXME debugging */
 #define IF_DEBUG(x)  if(DEBUG) { x; }
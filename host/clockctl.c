@@ -0,0 +1,162 @@
+/*
+ * Command-line client for the clock's binary serial protocol.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clocklink.h"
+
+#define TIMEOUT_MS 2000
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s TTY COMMAND [ARGS]\n"
+          "  ping\n"
+          "  time\n"
+          "  set-time HOURS MINUTES SECONDS DAY DATE MONTH YEAR [12]\n"
+          "  alarms\n"
+          "  set-alarm HOURS MINUTES [DAYS]\n"
+          "  clear-alarm N\n"
+          "  stats\n"
+          "  speak ALLOPHONE...\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+static uint16_t
+get16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+  return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint8_t
+arg8(const char *s)
+{
+  char *end;
+  long v = strtol(s, &end, 0);
+
+  if(*s == '\0' || *end != '\0' || v < 0 || v > 255) {
+    fprintf(stderr, "bad number: %s\n", s);
+    exit(EXIT_FAILURE);
+  }
+
+  return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint8_t req[FRAME_MAX_PAYLOAD];
+  uint8_t reply[FRAME_MAX_PAYLOAD];
+  uint8_t len = 0;
+  frame_opcode_t op;
+  frame_status_t status;
+  const char *cmd;
+  int fd, n;
+
+  if(argc < 3) {
+    usage(argv[0]);
+  }
+  cmd = argv[2];
+
+  if(strcmp(cmd, "ping") == 0) {
+    op = FRAME_PING;
+    memcpy(req, "ping", 4);
+    len = 4;
+  } else if(strcmp(cmd, "time") == 0) {
+    op = FRAME_GET_TIME;
+  } else if(strcmp(cmd, "set-time") == 0 && (argc == 10 || argc == 11)) {
+    op = FRAME_SET_TIME;
+    for(int i = 0; i < 7; i++) {
+      req[i] = arg8(argv[3 + i]);
+    }
+    req[7] = argc == 11;
+    len = sizeof(struct frame_time_t);
+  } else if(strcmp(cmd, "alarms") == 0) {
+    op = FRAME_GET_ALARMS;
+  } else if(strcmp(cmd, "set-alarm") == 0 && (argc == 5 || argc == 6)) {
+    op = FRAME_SET_ALARM;
+    req[0] = arg8(argv[3]);
+    req[1] = arg8(argv[4]);
+    req[2] = argc == 6 ? arg8(argv[5]) : 0x7F;
+    len = sizeof(struct frame_alarm_t);
+  } else if(strcmp(cmd, "clear-alarm") == 0 && argc == 4) {
+    op = FRAME_CLEAR_ALARM;
+    req[0] = arg8(argv[3]);
+    len = 1;
+  } else if(strcmp(cmd, "stats") == 0) {
+    op = FRAME_GET_STATS;
+  } else if(strcmp(cmd, "speak") == 0 && argc > 3 && argc - 3 <= FRAME_MAX_PAYLOAD) {
+    op = FRAME_SPEAK;
+    for(int i = 3; i < argc; i++) {
+      req[len++] = arg8(argv[i]);
+    }
+  } else {
+    usage(argv[0]);
+  }
+
+  if((fd = clocklink_open(argv[1])) < 0) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  n = clocklink_request(fd, op, req, len, &status, reply, TIMEOUT_MS);
+  clocklink_close(fd);
+
+  if(n < 0) {
+    perror(cmd);
+    return EXIT_FAILURE;
+  }
+  if(status != FRAME_OK) {
+    fprintf(stderr, "%s: clock says %d\n", cmd, status);
+    return EXIT_FAILURE;
+  }
+
+  switch(op) {
+  case FRAME_PING:
+    printf("%.*s\n", n, (const char *)reply);
+    break;
+  case FRAME_GET_TIME:
+    if(n == sizeof(struct frame_time_t)) {
+      printf("%02d:%02d:%02d day %d %02d/%02d/%02d%s\n",
+             reply[0], reply[1], reply[2], reply[3],
+             reply[4], reply[5], reply[6], reply[7] ? " (12h)" : "");
+    }
+    break;
+  case FRAME_GET_ALARMS:
+    for(int i = 0; i + 3 <= n; i += 3) {
+      printf("%d %02d:%02d days 0x%02x\n", i / 3, reply[i], reply[i + 1], reply[i + 2]);
+    }
+    break;
+  case FRAME_GET_STATS:
+    if(n == sizeof(struct frame_stats_t)) {
+      const struct frame_stats_t *s = (const struct frame_stats_t *)reply;
+
+      printf("rx dropped %u overrun %u framing %u\n",
+             get16(s->rx_dropped), get16(s->rx_overrun), get16(s->rx_framing));
+      printf("clock drift ppm %d last error ms %d syncs %u\n",
+             (int32_t)get32(s->clock_ppm), (int32_t)get32(s->clock_error_ms),
+             get16(s->clock_syncs));
+    }
+    break;
+  default:
+    break;
+  }
+
+  return EXIT_SUCCESS;
+}
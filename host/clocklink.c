@@ -0,0 +1,282 @@
+/*
+ * Talk to the clock over its serial port using binary frames, see
+ * ../include/frame.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+/* cfmakeraw */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc8.h"
+#include "clocklink.h"
+
+/* Each try gets its own, so a late reply isn't taken for the latest. */
+static uint8_t next_seq;
+
+/* Milliseconds, for timeouts. */
+static long
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Read one byte before the deadline. */
+static int
+read_byte(int fd, uint8_t *c, long deadline)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+  for(;;) {
+    long left = deadline - now_ms();
+    int r;
+
+    if(left <= 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    r = poll(&pfd, 1, left);
+    if(r < 0 && errno != EINTR) {
+      return -1;
+    }
+    if(r > 0) {
+      r = read(fd, c, 1);
+      if(r == 1) {
+        return 0;
+      }
+      if(r == 0) {
+        errno = EIO;
+        return -1;
+      }
+      if(errno != EINTR && errno != EAGAIN) {
+        return -1;
+      }
+    }
+  }
+}
+
+/* **************************************** */
+
+int
+clocklink_open(const char *path)
+{
+  struct termios tio;
+  int fd;
+
+  if((fd = open(path, O_RDWR | O_NOCTTY)) < 0) {
+    return -1;
+  }
+
+  if(tcgetattr(fd, &tio) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B9600);
+  cfsetospeed(&tio, B9600);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+
+  if(tcsetattr(fd, TCSANOW, &tio) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  tcflush(fd, TCIOFLUSH);
+
+  return fd;
+}
+
+void
+clocklink_close(int fd)
+{
+  close(fd);
+}
+
+int
+clocklink_send(int fd, uint8_t opcode, uint8_t seq,
+               const uint8_t *payload, uint8_t len)
+{
+  uint8_t buf[FRAME_OVERHEAD + FRAME_MAX_PAYLOAD];
+  size_t n = 0;
+
+  if(len > FRAME_MAX_PAYLOAD) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  buf[0] = FRAME_SOF;
+  buf[1] = len;
+  buf[2] = opcode;
+  buf[3] = seq;
+  memcpy(&buf[4], payload, len);
+  buf[4 + len] = crc8(&buf[1], 3 + len);
+
+  while(n < FRAME_OVERHEAD + (size_t)len) {
+    ssize_t w = write(fd, buf + n, FRAME_OVERHEAD + len - n);
+
+    if(w < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    n += w;
+  }
+
+  return 0;
+}
+
+int
+clocklink_recv(int fd, uint8_t *opcode, uint8_t *seq,
+               uint8_t *payload, int timeout_ms)
+{
+  long deadline = now_ms() + timeout_ms;
+  uint8_t buf[3 + FRAME_MAX_PAYLOAD];
+  uint8_t c;
+
+  for(;;) {
+    /* Skip anything that isn't a frame, e.g. debugging output. */
+    do {
+      if(read_byte(fd, &c, deadline) < 0) {
+        return -1;
+      }
+    } while(c != FRAME_SOF);
+
+    if(read_byte(fd, &buf[0], deadline) < 0) {
+      return -1;
+    }
+    if(buf[0] > FRAME_MAX_PAYLOAD) {
+      continue;
+    }
+
+    for(uint8_t i = 1; i < 3 + buf[0]; i++) {
+      if(read_byte(fd, &buf[i], deadline) < 0) {
+        return -1;
+      }
+    }
+    if(read_byte(fd, &c, deadline) < 0) {
+      return -1;
+    }
+
+    if(crc8(buf, 3 + buf[0]) != c) {
+      errno = EBADMSG;
+      return -1;
+    }
+
+    *opcode = buf[1];
+    *seq = buf[2];
+    memcpy(payload, &buf[3], buf[0]);
+    return buf[0];
+  }
+}
+
+/* Send a newline and give the clock time to wake up on it. */
+static int
+wake(int fd)
+{
+  const uint8_t nl = '\n';
+  struct timespec ts = { 0, CLOCKLINK_WAKE_MS * 1000000L };
+  ssize_t w;
+
+  while((w = write(fd, &nl, 1)) < 0 && errno == EINTR)
+    ;
+  if(w < 0) {
+    return -1;
+  }
+
+  while(nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    ;
+
+  return 0;
+}
+
+bool
+clocklink_idempotent(uint8_t opcode)
+{
+  switch(opcode) {
+  case FRAME_PING:
+  case FRAME_GET_TIME:
+  case FRAME_GET_ALARMS:
+  case FRAME_GET_STATS:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+int
+clocklink_request(int fd, uint8_t opcode,
+                  const uint8_t *payload, uint8_t len,
+                  frame_status_t *status, uint8_t *reply, int timeout_ms)
+{
+  uint8_t buf[FRAME_MAX_PAYLOAD];
+  uint8_t rop, rseq;
+  int n = -1;
+
+  for(int tries = 0; tries < CLOCKLINK_TRIES; tries++) {
+    uint8_t seq = next_seq++;
+    long deadline;
+
+    /* Whatever is waiting is from before: a reply we gave up on, or
+       the clock's chatter. */
+    tcflush(fd, TCIFLUSH);
+
+    if(wake(fd) < 0 || clocklink_send(fd, opcode, seq, payload, len) < 0) {
+      return -1;
+    }
+
+    deadline = now_ms() + timeout_ms;
+    do {
+      n = clocklink_recv(fd, &rop, &rseq, buf, deadline - now_ms());
+    } while(n >= 0 && rseq != seq);
+
+    if(n < 0) {
+      if((errno == ETIMEDOUT || errno == EBADMSG)
+         && clocklink_idempotent(opcode)) {
+        continue;
+      }
+      return -1;
+    }
+
+    if(rop != (opcode | FRAME_REPLY) || n < 1) {
+      errno = EPROTO;
+      return -1;
+    }
+
+    if(buf[0] == FRAME_BAD_CRC) {
+      n = -1;
+      errno = EBADMSG;
+      continue;
+    }
+
+    break;
+  }
+
+  if(n < 0) {
+    return -1;
+  }
+
+  *status = buf[0];
+  memcpy(reply, &buf[1], n - 1);
+
+  return n - 1;
+}
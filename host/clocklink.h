@@ -0,0 +1,63 @@
+/*
+ * Talk to the clock over its serial port using binary frames, see
+ * ../include/frame.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _CLOCKLINK_H_
+#define _CLOCKLINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+/* Open and configure a serial port: 9600 8N1, raw. Returns a file
+   descriptor, or -1 with errno set. */
+int clocklink_open(const char *path);
+
+void clocklink_close(int fd);
+
+/* Send a frame. Returns 0, or -1 with errno set. */
+int clocklink_send(int fd, uint8_t opcode, uint8_t seq,
+                   const uint8_t *payload, uint8_t len);
+
+/*
+ * Wait up to timeout_ms for a frame, skipping any text before it.
+ * On success returns the payload length (at most FRAME_MAX_PAYLOAD)
+ * and sets *opcode and *seq. Returns -1 with errno set: ETIMEDOUT or
+ * EBADMSG for a bad CRC, say.
+ */
+int clocklink_recv(int fd, uint8_t *opcode, uint8_t *seq,
+                   uint8_t *payload, int timeout_ms);
+
+/*
+ * The clock's UART is off while it sleeps, and the character that
+ * wakes it is lost. So each request is preceded by a newline (which
+ * also ends any half-typed text command) and a pause while it wakes.
+ */
+#define CLOCKLINK_WAKE_MS 20
+
+/* Tries at a request that gets no good reply. */
+#define CLOCKLINK_TRIES 3
+
+/* Can this request be carried out twice without harm? */
+bool clocklink_idempotent(uint8_t opcode);
+
+/*
+ * Wake the clock, send a request and wait for its reply, ignoring
+ * replies to anything sent before. If the clock says the request was
+ * garbled it didn't act on it, and it's sent again. If the reply is
+ * lost or garbled, only an idempotent request is sent again: anything
+ * else may or may not have been done, and fails with ETIMEDOUT or
+ * EBADMSG for the caller to find out which. On success returns the
+ * length of the reply payload after the status byte, which goes in
+ * *status. Returns -1 with errno set on failure.
+ */
+int clocklink_request(int fd, uint8_t opcode,
+                      const uint8_t *payload, uint8_t len,
+                      frame_status_t *status, uint8_t *reply, int timeout_ms);
+
+#endif /* _CLOCKLINK_H_ */
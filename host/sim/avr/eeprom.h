@@ -0,0 +1,23 @@
+/*
+ * Simulated avr/eeprom.h, backed by an array.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The linker gathers EEMEM objects into one section, whose bounds
+   sim.c uses to check that what's passed in really is in EEPROM. */
+#define EEMEM __attribute__((section("sim_eeprom")))
+
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_update_byte(uint8_t *p, uint8_t v);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif /* _SIM_AVR_EEPROM_H_ */
@@ -0,0 +1,19 @@
+/*
+ * Simulated avr/interrupt.h. Handlers are ordinary functions that
+ * tests call.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void); void vector(void)
+
+#define cli() ((void)(SREG &= ~_BV(SREG_I)))
+#define sei() ((void)(SREG |= _BV(SREG_I)))
+
+#endif /* _SIM_AVR_INTERRUPT_H_ */
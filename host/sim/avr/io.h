@@ -0,0 +1,123 @@
+/*
+ * Simulated avr/io.h: the ATmega328P registers we use, as variables.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+
+#define SIM_REG(n) extern volatile uint8_t n;
+
+SIM_REG(SREG)
+
+SIM_REG(UCSR0A) SIM_REG(UCSR0B) SIM_REG(UCSR0C) SIM_REG(UDR0)
+SIM_REG(UBRR0H) SIM_REG(UBRR0L)
+
+SIM_REG(TWCR) SIM_REG(TWSR) SIM_REG(TWDR) SIM_REG(TWBR) SIM_REG(TWAR)
+
+SIM_REG(PORTB) SIM_REG(PORTC) SIM_REG(PORTD)
+SIM_REG(PINB) SIM_REG(PINC) SIM_REG(PIND)
+SIM_REG(DDRB) SIM_REG(DDRC) SIM_REG(DDRD)
+
+SIM_REG(PCMSK0) SIM_REG(PCMSK1) SIM_REG(PCMSK2) SIM_REG(PCICR) SIM_REG(PCIFR)
+SIM_REG(WDTCSR) SIM_REG(MCUCR) SIM_REG(MCUSR) SIM_REG(ACSR) SIM_REG(ADCSRA)
+
+SIM_REG(TCCR0A) SIM_REG(TCCR0B) SIM_REG(TCNT0) SIM_REG(TIMSK0) SIM_REG(TIFR0)
+SIM_REG(TCCR1A) SIM_REG(TCCR1B) SIM_REG(TIMSK1) SIM_REG(TIFR1)
+SIM_REG(TCCR2A) SIM_REG(TCCR2B) SIM_REG(TCNT2) SIM_REG(OCR2A) SIM_REG(TIMSK2) SIM_REG(TIFR2)
+extern volatile uint16_t TCNT1;
+
+#define SREG_I 7
+
+/* USART0 */
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define FE0    4
+#define DOR0   3
+#define UPE0   2
+#define U2X0   1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ00 1
+#define UCSZ01 2
+
+/* TWI */
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+#define TWPS0 0
+#define TWPS1 1
+
+/* Ports */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+
+/* Pin change interrupts */
+#define PCINT6  6
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT16 0
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+
+/* Watchdog */
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE  3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+#define WDRF 3
+
+/* Timers */
+#define CS00  0
+#define CS01  1
+#define CS02  2
+#define TOV0  0
+#define TOIE0 0
+#define CS10  0
+#define CS11  1
+#define CS12  2
+#define TOV1  0
+#define TOIE1 0
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM21  1
+#define OCF2A  1
+#define OCIE2A 1
+
+#define E2END 1023
+
+#endif /* _SIM_AVR_IO_H_ */
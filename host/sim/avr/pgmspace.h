@@ -0,0 +1,25 @@
+/*
+ * Simulated avr/pgmspace.h: program memory is just memory.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_PGMSPACE_H_
+#define _SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+/* Also used for tables of pointers, which are wider than a word here. */
+#define pgm_read_word(p) (*(p))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif /* _SIM_AVR_PGMSPACE_H_ */
@@ -0,0 +1,23 @@
+/*
+ * Simulated avr/power.h: nothing to switch.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_POWER_H_
+#define _SIM_AVR_POWER_H_
+
+#define power_all_disable()     ((void)0)
+#define power_usart0_enable()   ((void)0)
+#define power_usart0_disable()  ((void)0)
+#define power_twi_enable()      ((void)0)
+#define power_twi_disable()     ((void)0)
+#define power_timer0_enable()   ((void)0)
+#define power_timer0_disable()  ((void)0)
+#define power_timer1_enable()   ((void)0)
+#define power_timer1_disable()  ((void)0)
+#define power_timer2_enable()   ((void)0)
+#define power_timer2_disable()  ((void)0)
+
+#endif /* _SIM_AVR_POWER_H_ */
@@ -0,0 +1,20 @@
+/*
+ * Simulated avr/sleep.h: sleeping runs sim_sleep_hook, see sim.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_SLEEP_H_
+#define _SIM_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_PWR_DOWN 2
+
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_enable()       ((void)0)
+#define sleep_disable()      ((void)0)
+
+void sleep_cpu(void);
+
+#endif /* _SIM_AVR_SLEEP_H_ */
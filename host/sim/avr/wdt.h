@@ -0,0 +1,16 @@
+/*
+ * Simulated avr/wdt.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_AVR_WDT_H_
+#define _SIM_AVR_WDT_H_
+
+/* Counted, so tests can tell when the WDT was restarted. */
+extern unsigned sim_wdt_resets;
+
+#define wdt_reset() ((void)sim_wdt_resets++)
+
+#endif /* _SIM_AVR_WDT_H_ */
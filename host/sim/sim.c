@@ -0,0 +1,179 @@
+/*
+ * Just enough of an ATmega328P to run driver code on a PC.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include <util/delay_basic.h>
+
+#include "sim.h"
+
+/* **************************************** */
+
+#define SIM_REG_DEF(n) volatile uint8_t n;
+
+SIM_REG_DEF(SREG)
+
+SIM_REG_DEF(UCSR0A) SIM_REG_DEF(UCSR0B) SIM_REG_DEF(UCSR0C) SIM_REG_DEF(UDR0)
+SIM_REG_DEF(UBRR0H) SIM_REG_DEF(UBRR0L)
+
+SIM_REG_DEF(TWCR) SIM_REG_DEF(TWSR) SIM_REG_DEF(TWDR) SIM_REG_DEF(TWBR) SIM_REG_DEF(TWAR)
+
+SIM_REG_DEF(PORTB) SIM_REG_DEF(PORTC) SIM_REG_DEF(PORTD)
+SIM_REG_DEF(PINB) SIM_REG_DEF(PINC) SIM_REG_DEF(PIND)
+SIM_REG_DEF(DDRB) SIM_REG_DEF(DDRC) SIM_REG_DEF(DDRD)
+
+SIM_REG_DEF(PCMSK0) SIM_REG_DEF(PCMSK1) SIM_REG_DEF(PCMSK2) SIM_REG_DEF(PCICR) SIM_REG_DEF(PCIFR)
+SIM_REG_DEF(WDTCSR) SIM_REG_DEF(MCUCR) SIM_REG_DEF(MCUSR) SIM_REG_DEF(ACSR) SIM_REG_DEF(ADCSRA)
+
+SIM_REG_DEF(TCCR0A) SIM_REG_DEF(TCCR0B) SIM_REG_DEF(TCNT0) SIM_REG_DEF(TIMSK0) SIM_REG_DEF(TIFR0)
+SIM_REG_DEF(TCCR1A) SIM_REG_DEF(TCCR1B) SIM_REG_DEF(TIMSK1) SIM_REG_DEF(TIFR1)
+SIM_REG_DEF(TCCR2A) SIM_REG_DEF(TCCR2B) SIM_REG_DEF(TCNT2) SIM_REG_DEF(OCR2A) SIM_REG_DEF(TIMSK2) SIM_REG_DEF(TIFR2)
+volatile uint16_t TCNT1;
+
+unsigned sim_wdt_resets;
+
+void (*sim_sleep_hook)(void);
+void (*sim_delay_hook)(sim_delay_t kind, double amount);
+
+static uint8_t eeprom[E2END + 1];
+
+unsigned sim_checks, sim_failures;
+
+/* **************************************** */
+
+void
+sim_reset(void)
+{
+  SREG = 0;
+  for(size_t i = 0; i < sizeof eeprom; i++) {
+    eeprom[i] = 0xFF;
+  }
+  UCSR0A = UCSR0B = UCSR0C = UDR0 = UBRR0H = UBRR0L = 0;
+  TWCR = TWSR = TWDR = TWBR = TWAR = 0;
+  PORTB = PORTC = PORTD = PINB = PINC = PIND = DDRB = DDRC = DDRD = 0;
+  PCMSK0 = PCMSK1 = PCMSK2 = PCICR = PCIFR = 0;
+  WDTCSR = MCUCR = MCUSR = ACSR = ADCSRA = 0;
+  TCCR0A = TCCR0B = TCNT0 = TIMSK0 = TIFR0 = 0;
+  TCCR1A = TCCR1B = TIMSK1 = TIFR1 = 0;
+  TCCR2A = TCCR2B = TCNT2 = OCR2A = TIMSK2 = TIFR2 = 0;
+  TCNT1 = 0;
+  sim_wdt_resets = 0;
+
+  sim_sleep_hook = NULL;
+  sim_delay_hook = NULL;
+}
+
+void
+sleep_cpu(void)
+{
+  if(!sim_sleep_hook) {
+    fprintf(stderr, "slept with nothing to wake us\n");
+    abort();
+  }
+  sim_sleep_hook();
+}
+
+static void
+delay(sim_delay_t kind, double amount)
+{
+  if(sim_delay_hook) {
+    sim_delay_hook(kind, amount);
+  }
+}
+
+void
+_delay_us(double us)
+{
+  delay(SIM_DELAY_US, us);
+}
+
+void
+_delay_ms(double ms)
+{
+  delay(SIM_DELAY_MS, ms);
+}
+
+void
+_delay_loop_1(uint8_t count)
+{
+  delay(SIM_DELAY_LOOP_1, count);
+}
+
+/* **************************************** */
+
+/* EEMEM variables are only used for their addresses: their offsets
+   into the section are the EEPROM's. Anything else is a bug, like
+   EEMEM on a type rather than the object. */
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+static uint8_t *
+eeprom_at(const void *p)
+{
+  const uint8_t *q = p;
+
+  if(q < __start_sim_eeprom || q >= __stop_sim_eeprom
+     || (size_t)(q - __start_sim_eeprom) >= sizeof eeprom) {
+    fprintf(stderr, "EEPROM access to %p, not an EEMEM object\n", p);
+    abort();
+  }
+
+  return &eeprom[q - __start_sim_eeprom];
+}
+
+uint8_t
+eeprom_read_byte(const uint8_t *p)
+{
+  return *eeprom_at(p);
+}
+
+void
+eeprom_update_byte(uint8_t *p, uint8_t v)
+{
+  *eeprom_at(p) = v;
+}
+
+void
+eeprom_read_block(void *dst, const void *src, size_t n)
+{
+  for(size_t i = 0; i < n; i++) {
+    ((uint8_t *)dst)[i] = *eeprom_at((const uint8_t *)src + i);
+  }
+}
+
+void
+eeprom_update_block(const void *src, void *dst, size_t n)
+{
+  for(size_t i = 0; i < n; i++) {
+    *eeprom_at((uint8_t *)dst + i) = ((const uint8_t *)src)[i];
+  }
+}
+
+/* **************************************** */
+
+void
+sim_check(int ok, const char *what, const char *file, int line)
+{
+  sim_checks++;
+  if(!ok) {
+    sim_failures++;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  }
+}
+
+int
+sim_done(const char *name)
+{
+  printf("%s: %u checks, %u failed\n", name, sim_checks, sim_failures);
+  return sim_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+/*
+ * Just enough of an ATmega328P to run driver code on a PC.
+ *
+ * The registers are plain variables and nothing happens by itself:
+ * tests play the part of the hardware by setting registers and calling
+ * the interrupt handlers, either directly or from the hooks below.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+/* sleep_cpu(): deliver whatever interrupt would wake us. Without one,
+   sleeping would be forever and the test aborts. */
+extern void (*sim_sleep_hook)(void);
+
+/* _delay_us(), _delay_ms() and _delay_loop_1(); the unit is the
+   argument's. Useful for sampling port pins mid-strobe. */
+typedef enum {
+  SIM_DELAY_US,
+  SIM_DELAY_MS,
+  SIM_DELAY_LOOP_1,
+} sim_delay_t;
+
+extern void (*sim_delay_hook)(sim_delay_t kind, double amount);
+
+/* Zero all the registers and hooks, and erase the EEPROM. */
+void sim_reset(void);
+
+/* **************************************** */
+/* A minimal test harness. */
+
+extern unsigned sim_checks, sim_failures;
+
+#define CHECK(cond) sim_check((cond), #cond, __FILE__, __LINE__)
+
+void sim_check(int ok, const char *what, const char *file, int line);
+
+/* Print a summary. The exit status for main(). */
+int sim_done(const char *name);
+
+#endif /* _SIM_H_ */
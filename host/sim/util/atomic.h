@@ -0,0 +1,40 @@
+/*
+ * Simulated util/atomic.h. As in avr-libc, the saved SREG is restored
+ * however the block is left.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+#include <avr/io.h>
+
+static inline uint8_t
+sim_irq_save(void)
+{
+  uint8_t s = SREG;
+
+  SREG &= ~_BV(SREG_I);
+  return s;
+}
+
+static inline void
+sim_irq_restore(const uint8_t *s)
+{
+  SREG = *s;
+}
+
+static inline uint8_t
+sim_once(void)
+{
+  return 1;
+}
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type)                                              \
+  for(uint8_t sim_sreg __attribute__((__cleanup__(sim_irq_restore))) = sim_irq_save(), \
+        sim_todo = sim_once(); sim_todo; sim_todo = 0)
+
+#endif /* _SIM_UTIL_ATOMIC_H_ */
@@ -0,0 +1,14 @@
+/*
+ * Simulated util/delay.h: delays run sim_delay_hook, see sim.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_UTIL_DELAY_H_
+#define _SIM_UTIL_DELAY_H_
+
+void _delay_us(double us);
+void _delay_ms(double ms);
+
+#endif /* _SIM_UTIL_DELAY_H_ */
@@ -0,0 +1,15 @@
+/*
+ * Simulated util/delay_basic.h.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _SIM_UTIL_DELAY_BASIC_H_
+#define _SIM_UTIL_DELAY_BASIC_H_
+
+#include <stdint.h>
+
+void _delay_loop_1(uint8_t count);
+
+#endif /* _SIM_UTIL_DELAY_BASIC_H_ */
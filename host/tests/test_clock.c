@@ -0,0 +1,268 @@
+/*
+ * The SRAM clock's drift correction against a fake DS1307.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sim.h"
+#include "clock.h"
+#include "ds1307.h"
+#include "timebase.h"
+#include "timers.h"
+
+/* **************************************** */
+/* The DS1307, the time base and the timers. */
+
+static uint64_t rtc_ms;           /* Since Monday midnight. */
+static uint32_t wdt_ms;           /* Where timers_now() would be. */
+static uint32_t now_ms;           /* What it says: as of the last tick. */
+static uint8_t epoch;
+static timebase_t tb = TIMEBASE_WDT;
+
+static uint8_t nvram[DS1307_NVRAM_LEN];
+static unsigned nvram_writes;
+
+bool
+ds1307_read(struct ds1307_time_t *t)
+{
+  uint32_t s = rtc_ms / 1000;
+
+  memset(t, 0, sizeof(*t));
+  t->seconds = s % 60;
+  t->minutes = s / 60 % 60;
+  t->hours = s / 3600 % 24;
+  t->day = s / CLOCK_SECONDS_PER_DAY % 7 + 1;
+  t->date = 1;
+  t->month = 1;
+
+  return true;
+}
+
+bool
+ds1307_nvram_read(uint8_t offset, uint8_t *buf, uint8_t len)
+{
+  memcpy(buf, &nvram[offset], len);
+  return true;
+}
+
+bool
+ds1307_nvram_write(uint8_t offset, const uint8_t *buf, uint8_t len)
+{
+  memcpy(&nvram[offset], buf, len);
+  nvram_writes++;
+  return true;
+}
+
+uint32_t
+timers_now(void)
+{
+  return now_ms;
+}
+
+uint8_t
+timers_epoch(void)
+{
+  return epoch;
+}
+
+timebase_t
+timebase_current(void)
+{
+  return tb;
+}
+
+/* Real time passes, with the time base ppm fast. */
+static void
+pass(uint32_t ms, int32_t ppm)
+{
+  rtc_ms += ms;
+  wdt_ms += (int64_t)ms * (1000000 + ppm) / 1000000;
+}
+
+/* The time base interrupts. */
+static void
+tick(void)
+{
+  now_ms = wdt_ms;
+}
+
+/* Seconds the SRAM clock is ahead of the DS1307, within a day. */
+static int32_t
+clock_error(void)
+{
+  uint32_t s;
+  uint8_t day;
+  int32_t e;
+
+  CHECK(clock_now(&s, &day));
+  e = (int32_t)s - (int32_t)(rtc_ms / 1000 % CLOCK_SECONDS_PER_DAY);
+
+  return e;
+}
+
+/* **************************************** */
+
+/* Hourly syncs on a tick with a 3% fast WDT: the correction converges
+   and the clock keeps time. */
+static void
+test_converges(void)
+{
+  struct clock_stats_t s;
+
+  for(unsigned i = 0; i < 24; i++) {
+    pass(3600000UL, 30000);
+    tick();
+    CHECK(clock_stale());
+    CHECK(clock_sync(true));
+    CHECK(!clock_stale());
+  }
+
+  clock_get_stats(&s);
+  /* The first, after clock_init(), only starts the measurement. */
+  CHECK(s.calibrations == 23);
+  CHECK(s.ppm > 29000 && s.ppm < 31000);
+
+  /* Half an hour on, by the SRAM clock alone. */
+  pass(1800000UL, 30000);
+  tick();
+  CHECK(clock_error() >= -2 && clock_error() <= 2);
+}
+
+/* A sync between ticks sees a stale timers_now(). It mustn't be used
+   to calibrate, and the clock wants reading again on the next tick. */
+static void
+test_off_tick(void)
+{
+  struct clock_stats_t before, after;
+
+  clock_get_stats(&before);
+
+  pass(8000, 30000);   /* Nearly a whole WDT period since the tick. */
+  CHECK(clock_sync(false));
+  CHECK(clock_stale());
+
+  pass(700000UL, 30000);
+  tick();
+  CHECK(clock_sync(true));
+  clock_get_stats(&after);
+  CHECK(after.calibrations == before.calibrations);
+  CHECK(after.ppm == before.ppm);
+  CHECK(!clock_stale());
+
+  /* The next one on a tick measures from there. */
+  pass(700000UL, 30000);
+  tick();
+  CHECK(clock_sync(true));
+  clock_get_stats(&after);
+  CHECK(after.calibrations == before.calibrations + 1);
+  CHECK(after.ppm > 29000 && after.ppm < 31000);
+}
+
+/* Setting the time makes the DS1307 jump: no garbage correction. */
+static void
+test_set_time(void)
+{
+  struct clock_stats_t before, after;
+  unsigned writes = nvram_writes;
+
+  clock_get_stats(&before);
+
+  rtc_ms += 5400000UL;
+  CHECK(clock_sync(false));
+
+  for(unsigned i = 0; i < 4; i++) {
+    pass(3600000UL, 30000);
+    tick();
+    CHECK(clock_sync(true));
+  }
+
+  clock_get_stats(&after);
+  CHECK(after.calibrations == before.calibrations + 3);
+  CHECK(after.ppm > 29000 && after.ppm < 31000);
+  CHECK(nvram_writes == writes + 3);
+}
+
+/* Switching the time base loses time: nothing is measured across it. */
+static void
+test_epoch(void)
+{
+  struct clock_stats_t before, after;
+
+  clock_get_stats(&before);
+
+  pass(3600000UL, 30000);
+  tick();
+  epoch++;
+  wdt_ms -= 5000;
+  now_ms = wdt_ms;
+  CHECK(clock_stale());
+  CHECK(clock_sync(true));
+
+  pass(3600000UL, 30000);
+  tick();
+  CHECK(clock_sync(true));
+
+  clock_get_stats(&after);
+  CHECK(after.calibrations == before.calibrations + 1);
+  CHECK(after.ppm > 29000 && after.ppm < 31000);
+}
+
+/* The square wave is the DS1307's own: no correction applied, none
+   measured. */
+static void
+test_sqw(void)
+{
+  struct clock_stats_t before, after;
+
+  clock_get_stats(&before);
+
+  tb = TIMEBASE_SQW;
+  epoch++;
+  tick();
+  CHECK(clock_sync(true));
+
+  for(unsigned i = 0; i < 3; i++) {
+    pass(3600000UL, 0);
+    tick();
+    CHECK(clock_error() == 0);
+    CHECK(clock_sync(true));
+  }
+
+  clock_get_stats(&after);
+  CHECK(after.calibrations == before.calibrations);
+  CHECK(after.ppm == before.ppm);
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  struct clock_stats_t s;
+
+  sim_reset();
+
+  rtc_ms = 3 * CLOCK_SECONDS_PER_DAY * 1000ULL + 12345678;
+  CHECK(clock_init());
+  clock_get_stats(&s);
+  CHECK(s.ppm == 0);
+
+  test_converges();
+  test_off_tick();
+  test_set_time();
+  test_epoch();
+  test_sqw();
+
+  /* The correction survives a restart. */
+  tb = TIMEBASE_WDT;
+  CHECK(clock_init());
+  clock_get_stats(&s);
+  CHECK(s.ppm > 29000 && s.ppm < 31000);
+
+  return sim_done("clock");
+}
@@ -0,0 +1,430 @@
+/*
+ * clocklink.c against the AVR's frame.c over a pseudo-terminal, with
+ * a fake clock that sleeps, loses replies, stalls and answers late.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+/* posix_openpt */
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "clocklink.h"
+#include "crc8.h"
+#include "frame.h"
+#include "timers.h"
+#include "uart.h"
+
+#define TIMEOUT_MS 300
+
+/* The real clock listens for TIMER_UART_IDLE_MS after the last
+   character; less will do here. */
+#define LISTEN_MS 500
+
+/* **************************************** */
+/* The clock. Everything below is under lock. */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int master;
+static bool quit;
+
+static bool asleep = true;
+static long last_rx;
+static long frame_deadline;   /* TIMER_FRAME, or 0. */
+
+static unsigned executed;     /* Frames with a good CRC. */
+static unsigned bad_crcs;     /* Replies saying FRAME_BAD_CRC. */
+static unsigned woken;        /* Characters lost waking up. */
+static unsigned drop_replies; /* Replies to lose on the way back. */
+static bool dropping;
+static long delay_ms;         /* Before the next reply. */
+
+static unsigned out_pos;      /* Into the reply being sent. */
+static uint8_t out_len;
+
+static long
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void
+sleep_ms(long ms)
+{
+  struct timespec ts = { ms / 1000, ms % 1000 * 1000000L };
+
+  nanosleep(&ts, NULL);
+}
+
+void
+timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb)
+{
+  (void)period;
+  (void)cb;
+  if(id == TIMER_FRAME) {
+    frame_deadline = now_ms() + ms;
+  }
+}
+
+void
+timer_stop(timer_id_t id)
+{
+  if(id == TIMER_FRAME) {
+    frame_deadline = 0;
+  }
+}
+
+/* Watch replies go by for the status byte. */
+void
+uart_tx(uint8_t c)
+{
+  if(dropping) {
+    return;
+  }
+
+  if(out_pos == 0 && c != FRAME_SOF) {
+    return;
+  }
+  if(out_pos == 1) {
+    out_len = c;
+  }
+  if(out_pos == 4 && c == FRAME_BAD_CRC) {
+    bad_crcs++;
+  }
+  out_pos = out_pos == 4u + out_len ? 0 : out_pos + 1;
+
+  if(write(master, &c, 1) != 1) {
+    abort();
+  }
+}
+
+void
+uart_putstringP(const char *str, bool nl)
+{
+  (void)str;
+  (void)nl;
+}
+
+/* Ping, and clearing alarms that aren't there. */
+void
+frame_execute(uint8_t opcode, const uint8_t *payload, uint8_t len)
+{
+  executed++;
+
+  dropping = drop_replies > 0;
+  if(dropping) {
+    drop_replies--;
+  }
+
+  /* Busy elsewhere, and it didn't go well; what arrives meanwhile
+     waits in the buffer. */
+  if(delay_ms) {
+    sleep_ms(delay_ms);
+    delay_ms = 0;
+    frame_reply(opcode, FRAME_FAILED, NULL, 0);
+  } else if(opcode == FRAME_PING) {
+    frame_reply(opcode, FRAME_OK, payload, len);
+  } else if(opcode == FRAME_CLEAR_ALARM) {
+    frame_reply(opcode, FRAME_OK, NULL, 0);
+  } else {
+    frame_reply(opcode, FRAME_BAD_REQUEST, NULL, 0);
+  }
+
+  dropping = false;
+}
+
+static void *
+clock_main(void *arg)
+{
+  (void)arg;
+
+  for(;;) {
+    struct pollfd pfd = { .fd = master, .events = POLLIN };
+    int r = poll(&pfd, 1, 5);
+    uint8_t c;
+
+    pthread_mutex_lock(&lock);
+    if(quit) {
+      pthread_mutex_unlock(&lock);
+      return NULL;
+    }
+
+    if(r > 0 && (pfd.revents & POLLIN) && read(master, &c, 1) == 1) {
+      last_rx = now_ms();
+      if(asleep) {
+        /* Power-down: the edge wakes us, the character is lost. */
+        asleep = false;
+        woken++;
+      } else if(frame_active() || c == FRAME_SOF) {
+        frame_rx(c);
+      }
+    }
+
+    if(frame_deadline && now_ms() >= frame_deadline) {
+      frame_deadline = 0;
+      frame_timer();
+    }
+    if(!asleep && now_ms() - last_rx >= LISTEN_MS) {
+      asleep = true;
+    }
+
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+/* **************************************** */
+/* The host. */
+
+struct counts_t {
+  unsigned executed, bad_crcs, woken;
+};
+
+static struct counts_t
+counts(void)
+{
+  struct counts_t c;
+
+  pthread_mutex_lock(&lock);
+  c.executed = executed;
+  c.bad_crcs = bad_crcs;
+  c.woken = woken;
+  pthread_mutex_unlock(&lock);
+
+  return c;
+}
+
+static bool
+ping(int fd, const char *msg)
+{
+  uint8_t reply[FRAME_MAX_PAYLOAD];
+  frame_status_t status;
+  int n;
+
+  n = clocklink_request(fd, FRAME_PING, (const uint8_t *)msg, strlen(msg),
+                        &status, reply, TIMEOUT_MS);
+
+  return n == (int)strlen(msg) && status == FRAME_OK && memcmp(reply, msg, n) == 0;
+}
+
+static void
+put(int fd, const uint8_t *buf, size_t len)
+{
+  if(write(fd, buf, len) != (ssize_t)len) {
+    abort();
+  }
+}
+
+/* Asleep, a bare frame loses its SOF and goes nowhere. */
+static void
+test_needs_waking(int fd)
+{
+  struct counts_t before = counts();
+  uint8_t reply[FRAME_MAX_PAYLOAD];
+  uint8_t op, seq;
+
+  sleep_ms(LISTEN_MS + 100);
+  CHECK(clocklink_send(fd, FRAME_PING, 0, (const uint8_t *)"hi", 2) == 0);
+  CHECK(clocklink_recv(fd, &op, &seq, reply, TIMEOUT_MS) < 0 && errno == ETIMEDOUT);
+  CHECK(counts().executed == before.executed);
+  CHECK(counts().woken == before.woken + 1);
+}
+
+/* clocklink_request() wakes it first. */
+static void
+test_wake(int fd)
+{
+  struct counts_t before;
+
+  sleep_ms(LISTEN_MS + 100);
+  before = counts();
+  CHECK(ping(fd, "wake up"));
+  CHECK(counts().woken == before.woken + 1);
+  CHECK(counts().executed == before.executed + 1);
+
+  /* Awake, the newline is just text. */
+  CHECK(ping(fd, "again"));
+  CHECK(counts().woken == before.woken + 1);
+  CHECK(counts().executed == before.executed + 2);
+}
+
+/* A lost reply is tried again, and the clock does it twice. */
+static void
+test_retry(int fd)
+{
+  struct counts_t before = counts();
+
+  pthread_mutex_lock(&lock);
+  drop_replies = 1;
+  pthread_mutex_unlock(&lock);
+
+  CHECK(ping(fd, "retry"));
+  CHECK(counts().executed == before.executed + 2);
+
+  pthread_mutex_lock(&lock);
+  drop_replies = CLOCKLINK_TRIES;
+  pthread_mutex_unlock(&lock);
+
+  CHECK(!ping(fd, "give up"));
+  CHECK(errno == ETIMEDOUT);
+  CHECK(counts().executed == before.executed + 2 + CLOCKLINK_TRIES);
+}
+
+/* Clearing an alarm by index twice could clear the next one too: a
+   lost reply is the caller's problem. */
+static void
+test_no_retry(int fd)
+{
+  struct counts_t before = counts();
+  uint8_t index = 0, reply[FRAME_MAX_PAYLOAD];
+  frame_status_t status;
+
+  CHECK(!clocklink_idempotent(FRAME_CLEAR_ALARM));
+
+  pthread_mutex_lock(&lock);
+  drop_replies = 1;
+  pthread_mutex_unlock(&lock);
+
+  CHECK(clocklink_request(fd, FRAME_CLEAR_ALARM, &index, 1,
+                          &status, reply, TIMEOUT_MS) < 0);
+  CHECK(errno == ETIMEDOUT);
+  CHECK(counts().executed == before.executed + 1);
+}
+
+/* The first reply, a failure, turns up while we wait for the second:
+   it isn't taken for it. */
+static void
+test_late(int fd)
+{
+  struct counts_t before;
+
+  CHECK(ping(fd, "awake"));
+  before = counts();
+
+  pthread_mutex_lock(&lock);
+  delay_ms = TIMEOUT_MS + 100;
+  pthread_mutex_unlock(&lock);
+
+  CHECK(ping(fd, "slow"));
+  CHECK(counts().executed == before.executed + 2);
+  CHECK(ping(fd, "fast"));
+}
+
+/* Stale replies for every SEQ, already waiting: flushed, not read. */
+static void
+test_flush(int fd)
+{
+  struct counts_t before;
+
+  CHECK(ping(fd, "awake"));
+  before = counts();
+
+  pthread_mutex_lock(&lock);
+  for(unsigned seq = 0; seq < 256; seq++) {
+    uint8_t f[] = { FRAME_SOF, 3, FRAME_PING | FRAME_REPLY, seq, FRAME_OK, 'n', 'o', 0 };
+
+    f[7] = crc8(&f[1], 6);
+    if(write(master, f, sizeof(f)) != sizeof(f)) {
+      abort();
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  sleep_ms(50);
+
+  CHECK(ping(fd, "ok"));
+  CHECK(counts().executed == before.executed + 1);
+}
+
+/* Half a frame, then nothing: the clock gives up on it, and the next
+   one goes through first time. */
+static void
+test_stall(int fd)
+{
+  static const uint8_t half[] = { FRAME_SOF, 5, FRAME_PING, 0, 'x' };
+  struct counts_t before;
+
+  CHECK(ping(fd, "awake"));
+  before = counts();
+
+  put(fd, half, sizeof(half));
+  sleep_ms(FRAME_TIMEOUT_MS + 50);
+
+  CHECK(ping(fd, "after"));
+  CHECK(counts().executed == before.executed + 1);
+  CHECK(counts().bad_crcs == before.bad_crcs);
+}
+
+/* Noise that looks like SOF just before a frame. */
+static void
+test_resync(int fd)
+{
+  static const uint8_t sof = FRAME_SOF;
+  struct counts_t before;
+  uint8_t reply[FRAME_MAX_PAYLOAD];
+  uint8_t op, seq;
+
+  CHECK(ping(fd, "awake"));
+  before = counts();
+
+  put(fd, &sof, 1);
+  CHECK(clocklink_send(fd, FRAME_PING, 42, (const uint8_t *)"ok", 2) == 0);
+  CHECK(clocklink_recv(fd, &op, &seq, reply, TIMEOUT_MS) == 3);
+  CHECK(op == (FRAME_PING | FRAME_REPLY) && seq == 42 && reply[0] == FRAME_OK);
+  CHECK(counts().executed == before.executed + 1);
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  int fd;
+
+  if((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+     || grantpt(master) < 0 || unlockpt(master) < 0) {
+    return 77;
+  }
+
+  fd = clocklink_open(ptsname(master));
+  CHECK(fd >= 0);
+  if(fd < 0) {
+    return sim_done("clocklink");
+  }
+
+  last_rx = now_ms();
+  pthread_create(&thread, NULL, clock_main, NULL);
+
+  test_needs_waking(fd);
+  test_wake(fd);
+  test_retry(fd);
+  test_no_retry(fd);
+  test_late(fd);
+  test_flush(fd);
+  test_stall(fd);
+  test_resync(fd);
+
+  pthread_mutex_lock(&lock);
+  quit = true;
+  pthread_mutex_unlock(&lock);
+  pthread_join(thread, NULL);
+
+  clocklink_close(fd);
+  close(master);
+
+  return sim_done("clocklink");
+}
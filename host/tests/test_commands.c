@@ -0,0 +1,515 @@
+/*
+ * The command parser, a character at a time, against the 80-byte line
+ * buffer it replaced: valid commands, near misses and random streams,
+ * and how long each takes. Host timings only rank them.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+/* What the commands did: how many things, and a digest of them. A
+   rejected command must do nothing. */
+static unsigned acts;
+static uint32_t digest;
+
+static void
+act(uint32_t v)
+{
+  acts++;
+  digest = digest * 1000003UL + v + 1;
+}
+
+/* The speech layer proper isn't in this tree. */
+#define speak_P(w)      act(0x10000)
+#define speak_number(n) act(0x20000 | (n))
+
+/* parse_char() and execute_command() are static: take the file whole. */
+#include "commands.c"
+
+#define BENCH_ROUNDS 20000
+
+/* The last word on each line. */
+static const char *verdict;
+
+static const char ok[] = "ok";
+
+/* **************************************** */
+/* The rest of the clock. */
+
+void uart_tx(uint8_t c) { (void)c; }
+void uart_tx_nl(void) { }
+void uart_putw_dec(uint16_t w) { (void)w; }
+void uart_putsw_dec(int16_t w) { (void)w; }
+void uart_putl_dec(uint32_t l) { (void)l; }
+void uart_putsl_dec(int32_t l) { (void)l; }
+bool uart_rx(uint8_t *v) { (void)v; return false; }
+
+void
+uart_putstringP(const char *str, bool nl)
+{
+  (void)nl;
+  if(strcmp(str, ok) == 0) {
+    verdict = ok;
+  } else if(strncmp(str, "***", 3) == 0) {
+    verdict = str;
+  }
+}
+
+void uart_get_stats(struct uart_stats_t *s) { memset(s, 0, sizeof(*s)); }
+void events_get_stats(event_type_t t, struct events_stats_t *s) { (void)t; memset(s, 0, sizeof(*s)); }
+void clock_get_stats(struct clock_stats_t *s) { memset(s, 0, sizeof(*s)); }
+bool TWI_get_stats(uint8_t i, struct TWI_stats_t *s) { (void)i; (void)s; return false; }
+
+bool ds1307_read(struct ds1307_time_t *t) { memset(t, 0, sizeof(*t)); return true; }
+bool clock_get(struct ds1307_time_t *t) { memset(t, 0, sizeof(*t)); return true; }
+bool alarm_get(uint8_t i, struct alarm_t *a) { (void)i; (void)a; return false; }
+uint8_t temp_count(void) { return 1; }
+bool temp_get(uint8_t i, int16_t *t) { (void)i; *t = 0; return true; }
+
+bool mma7660fc_read_regs(uint8_t reg, uint8_t *buf, uint8_t len) { (void)reg; memset(buf, 0, len); return true; }
+bool mma7660fc_read_axes(int8_t *x, int8_t *y, int8_t *z) { *x = *y = *z = 0; return true; }
+bool mma7660fc_capture_read(struct mma7660fc_sample_t *s) { (void)s; return false; }
+uint16_t mma7660fc_capture_dropped(void) { return 0; }
+
+bool frame_active(void) { return false; }
+void frame_rx(uint8_t c) { (void)c; }
+void frame_reset(void) { }
+void frame_reply(uint8_t opcode, frame_status_t status, const uint8_t *payload, uint8_t len) { (void)opcode; (void)status; (void)payload; (void)len; }
+
+/* These change things. */
+void speak_allophone(allophone_t a) { act(0x30000 | a); }
+void sp0256_cancel(void) { act(0x40000); }
+bool ds1307_write(const struct ds1307_time_t *t) { act(0x50000 | t->hours << 8 | t->minutes); return true; }
+bool clock_sync(bool on_tick) { act(0x60000 | on_tick); return true; }
+bool alarm_add(const struct alarm_t *a) { act(0x70000 | a->hours << 8 | a->minutes); return true; }
+bool alarm_remove(uint8_t i) { act(0x80000 | i); return true; }
+bool temp_start(void) { act(0x90000); return true; }
+bool temp_search(void) { act(0xA0000); return true; }
+bool temp_set_precision(uint16_t p) { act(0xB0000 | p); return true; }
+bool timebase_select(timebase_t tb) { act(0xC0000 | tb); return true; }
+bool mma7660fc_capture_start(void) { act(0xD0000); return true; }
+bool mma7660fc_init_Bryan(void) { act(0xE0000); return true; }
+bool gesture_start(void) { act(0xF0000); return true; }
+bool gesture_stop(void) { act(0x100000); return true; }
+void timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb) { (void)id; (void)ms; (void)period; (void)cb; }
+
+/* **************************************** */
+/* The old way: buffer the line, then take it apart. Too long is bad. */
+
+#define COMMAND_BUFFER_SIZE 80
+
+static char command_buffer[COMMAND_BUFFER_SIZE];
+static uint8_t command_buffer_index;
+static bool command_buffer_overflow;
+
+static bool
+line_parse(keyword_t *cmd, uint8_t *nargs, uint16_t *args, uint16_t *kws)
+{
+  const char *b = command_buffer;
+  uint8_t n = command_buffer_index, i = 0;
+
+  *cmd = KW_NONE;
+  *nargs = 0;
+  *kws = 0;
+
+  while(i < n) {
+    uint8_t start, len;
+    uint16_t arg;
+    bool keyword;
+
+    if(b[i] == ' ' || b[i] == '\t') {
+      i++;
+      continue;
+    }
+
+    for(start = i; i < n && b[i] != ' ' && b[i] != '\t'; i++)
+      ;
+    len = i - start;
+
+    if(b[start] >= '0' && b[start] <= '9') {
+      uint32_t v = 0;
+
+      for(uint8_t j = start; j < i; j++) {
+        if(b[j] < '0' || b[j] > '9' || (v = v * 10 + (b[j] - '0')) > UINT16_MAX) {
+          return false;
+        }
+      }
+      arg = v;
+      keyword = false;
+    } else {
+      for(arg = 0; arg < KEYWORDS; arg++) {
+        PGM_P kw = (PGM_P)pgm_read_word(&keywords[arg]);
+
+        if(strlen_P(kw) == len && memcmp(kw, &b[start], len) == 0) {
+          break;
+        }
+      }
+      if(arg == KEYWORDS) {
+        return false;
+      }
+      keyword = true;
+    }
+
+    if(*cmd == KW_NONE) {
+      if(!keyword) {
+        return false;
+      }
+      *cmd = arg;
+    } else if(*nargs == CMD_MAX_ARGS) {
+      return false;
+    } else {
+      if(keyword) {
+        *kws |= 1U << *nargs;
+      }
+      args[(*nargs)++] = arg;
+    }
+  }
+
+  return true;
+}
+
+static void
+line_char(char c)
+{
+  if(c == '\r' || c == '\n') {
+    keyword_t cmd;
+    uint8_t nargs;
+    uint16_t args[CMD_MAX_ARGS], kws;
+
+    if(command_buffer_overflow || !line_parse(&cmd, &nargs, args, &kws)) {
+      uart_putstringP(PSTR("*** Bad command."), true);
+    } else if(cmd != KW_NONE) {
+      execute_command(cmd, nargs, args, kws);
+    }
+    command_buffer_index = 0;
+    command_buffer_overflow = false;
+    return;
+  }
+
+  if(command_buffer_index < COMMAND_BUFFER_SIZE - 1) {
+    command_buffer[command_buffer_index++] = c;
+  } else {
+    command_buffer_overflow = true;
+  }
+}
+
+/* **************************************** */
+
+struct outcome_t {
+  const char *verdict;
+  unsigned acts;
+  uint32_t digest;
+  bool overrun;
+};
+
+/* One line, then its end, through either parser. */
+static struct outcome_t
+run(void (*feed)(char), const char *line, size_t len)
+{
+  struct outcome_t o = { .overrun = false };
+
+  verdict = NULL;
+  acts = 0;
+  digest = 0;
+
+  for(size_t i = 0; i < len; i++) {
+    feed(line[i]);
+    o.overrun |= parser.nargs > CMD_MAX_ARGS;
+  }
+  feed('\n');
+
+  o.verdict = verdict;
+  o.acts = acts;
+  o.digest = digest;
+
+  return o;
+}
+
+static void
+stream_char(char c)
+{
+  parse_char(c);
+}
+
+#define LINE(s) { s, sizeof(s) - 1 }
+
+struct line_t {
+  const char *s;
+  size_t len;
+};
+
+static const struct line_t valid[] = {
+  LINE("stats"),
+  LINE("read-sensors"),
+  LINE("temperature"),
+  LINE("temperature search"),
+  LINE("temperature precision 625"),
+  LINE("set-time 12 30 0"),
+  LINE("set-time 12 30 0 1 18 10 26"),
+  LINE("set-alarm 7 0"),
+  LINE("set-alarm 7 0 62"),
+  LINE("clear-alarm 0"),
+  LINE("alarms"),
+  LINE("speak-allophones 1 2 63"),
+  LINE("speak-allophones 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16"),
+  LINE("speak-number 42"),
+  LINE("speak-number 65535"),
+  LINE("timebase wdt"),
+  LINE("timebase sqw"),
+  LINE("capture"),
+  LINE("trace"),
+  LINE("gestures"),
+  LINE("  set-time\t12  30 0 \r"),
+};
+
+static const struct line_t invalid[] = {
+  LINE("stat"),
+  LINE("statss"),
+  LINE("stats\0"),
+  LINE("stats\0x"),
+  LINE("stats 1"),
+  LINE("1 stats"),
+  LINE("Stats"),
+  LINE("temperature wdt"),
+  LINE("temperature precision"),
+  LINE("temperature precision search"),
+  LINE("set-time 12 30"),
+  LINE("set-time 12 30 0 1"),
+  LINE("set-time 12 wdt 0"),
+  LINE("set-time 256 0 0"),
+  LINE("set-alarm 7"),
+  LINE("clear-alarm"),
+  LINE("clear-alarm 256"),
+  LINE("clear-alarm 1x"),
+  LINE("speak-allophones"),
+  LINE("speak-allophones 1 2 64"),
+  LINE("speak-allophones 1 wdt"),
+  LINE("speak-allophones 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17"),
+  LINE("speak-number 65536"),
+  LINE("speak-number 99999999999"),
+  LINE("timebase"),
+  LINE("timebase 1"),
+  LINE("timebase sqw wdt"),
+};
+
+/* **************************************** */
+
+/* Accepted by both, and something done about it. */
+static void
+test_valid(void)
+{
+  for(unsigned i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+    struct outcome_t s = run(stream_char, valid[i].s, valid[i].len);
+    struct outcome_t l = run(line_char, valid[i].s, valid[i].len);
+
+    CHECK(s.verdict == ok);
+    CHECK(l.verdict == ok);
+    CHECK(s.digest == l.digest);
+  }
+}
+
+/* Refused by both, and nothing done, not even the allophones before
+   the bad one. */
+static void
+test_invalid(void)
+{
+  for(unsigned i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    struct outcome_t s = run(stream_char, invalid[i].s, invalid[i].len);
+    struct outcome_t l = run(line_char, invalid[i].s, invalid[i].len);
+
+    CHECK(s.verdict != NULL && s.verdict != ok);
+    CHECK(l.verdict != NULL && l.verdict != ok);
+    CHECK(s.acts == 0 && !s.overrun);
+  }
+}
+
+/* Far more arguments than fit, then a good command. */
+static void
+test_long(void)
+{
+  static char line[4000];
+  struct outcome_t o;
+
+  strcpy(line, "speak-allophones");
+  while(strlen(line) < sizeof(line) - 3) {
+    strcat(line, " 1");
+  }
+
+  o = run(stream_char, line, strlen(line));
+  CHECK(o.verdict != ok && o.acts == 0 && !o.overrun);
+
+  o = run(stream_char, "speak-number 7", 14);
+  CHECK(o.verdict == ok && o.acts == 1);
+}
+
+/* Keywords, near misses, numbers and junk, in lines short enough for
+   the buffer. */
+static size_t
+random_line(char *buf)
+{
+  size_t len = 0;
+  unsigned tokens = rand() % 8;
+
+  for(unsigned t = 0; t < tokens; t++) {
+    char tok[40];
+    size_t n;
+
+    switch(rand() % 8) {
+    case 0: case 1: case 2:
+      strcpy(tok, (PGM_P)pgm_read_word(&keywords[rand() % KEYWORDS]));
+      n = strlen(tok);
+      break;
+    case 3:
+      /* One letter off, a NUL perhaps, or one too many. */
+      strcpy(tok, (PGM_P)pgm_read_word(&keywords[rand() % KEYWORDS]));
+      n = strlen(tok);
+      if(rand() % 3) {
+        tok[rand() % n] = "-ae\0\xA5"[rand() % 5];
+      } else {
+        tok[n++] = "s\0"[rand() % 2];
+      }
+      break;
+    case 4:
+      n = sprintf(tok, "%d", rand() % 70);
+      break;
+    case 5:
+      n = sprintf(tok, "%ld", (long)(rand() % 70000));
+      break;
+    case 6:
+      n = 1 + rand() % 3;
+      for(size_t i = 0; i < n; i++) {
+        do {
+          tok[i] = rand();
+        } while(tok[i] == '\r' || tok[i] == '\n');
+      }
+      break;
+    default:
+      n = sprintf(tok, "%d%c", rand() % 10, 'a' + rand() % 26);
+      break;
+    }
+
+    if(len + n + 2 >= COMMAND_BUFFER_SIZE - 1) {
+      break;
+    }
+    if(t > 0 || rand() % 4 == 0) {
+      buf[len++] = rand() % 3 ? ' ' : '\t';
+    }
+    memcpy(&buf[len], tok, n);
+    len += n;
+  }
+
+  /* Mostly a command first. */
+  if(len > 0 && rand() % 2) {
+    PGM_P kw = (PGM_P)pgm_read_word(&keywords[rand() % 13]);
+    size_t n = strlen(kw);
+
+    if(len + n + 1 < COMMAND_BUFFER_SIZE - 1) {
+      memmove(&buf[n + 1], buf, len);
+      memcpy(buf, kw, n);
+      buf[n] = ' ';
+      len += n + 1;
+    }
+  }
+
+  return len;
+}
+
+/* Both parsers agree on every line, the character-at-a-time one never
+   overruns its arguments, and some of them are good commands. */
+static void
+test_random(void)
+{
+  unsigned accepted = 0;
+
+  srand(1);
+  for(unsigned i = 0; i < 100000; i++) {
+    char line[COMMAND_BUFFER_SIZE];
+    size_t len = random_line(line);
+    struct outcome_t s = run(stream_char, line, len);
+    struct outcome_t l = run(line_char, line, len);
+
+    if(s.overrun || s.verdict != l.verdict || s.digest != l.digest) {
+      CHECK(!"the parsers disagree");
+      fprintf(stderr, "  %.*s\n", (int)len, line);
+      return;
+    }
+    if(s.verdict != ok && s.acts != 0) {
+      CHECK(!"acted on a bad command");
+      return;
+    }
+    accepted += s.verdict == ok;
+  }
+
+  CHECK(accepted > 1000);
+}
+
+/* Any bytes at all, lines of any length. */
+static void
+test_noise(void)
+{
+  srand(2);
+  for(unsigned i = 0; i < 1000000; i++) {
+    parse_char(rand());
+    if(parser.nargs > CMD_MAX_ARGS) {
+      CHECK(!"args overrun");
+      return;
+    }
+  }
+  parse_char('\n');
+
+  CHECK(run(stream_char, "alarms", 6).verdict == ok);
+}
+
+/* **************************************** */
+
+static double
+bench(void (*feed)(char))
+{
+  clock_t start = clock();
+
+  for(unsigned r = 0; r < BENCH_ROUNDS; r++) {
+    for(unsigned i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+      run(feed, valid[i].s, valid[i].len);
+    }
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+run_bench(void)
+{
+  double lines = (double)BENCH_ROUNDS * (sizeof(valid) / sizeof(valid[0])) / 1e3;
+
+  printf("streaming     %.0f klines/s, %zu bytes of state\n",
+         lines / bench(stream_char), sizeof(parser));
+  printf("line-buffered %.0f klines/s, %zu bytes of buffer\n",
+         lines / bench(line_char), sizeof(command_buffer) + sizeof(command_buffer_index));
+}
+
+/* **************************************** */
+
+int
+main(int argc, char *argv[])
+{
+  test_valid();
+  test_invalid();
+  test_long();
+  test_random();
+  test_noise();
+
+  if(argc > 1 && strcmp(argv[1], "bench") == 0) {
+    run_bench();
+  }
+
+  return sim_done("commands");
+}
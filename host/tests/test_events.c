@@ -0,0 +1,102 @@
+/*
+ * The event queue between interrupt handlers and the controller.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "sim.h"
+#include "events.h"
+#include "timers.h"
+
+static uint32_t now;
+
+uint32_t
+timers_now(void)
+{
+  return now;
+}
+
+/* **************************************** */
+
+/* Every type at once fits, in order, however often each fires. */
+static void
+test_all_types(void)
+{
+  struct event_t e;
+
+  for(unsigned round = 0; round < 3; round++) {
+    for(unsigned t = 0; t < EVENT_TYPES; t++) {
+      for(unsigned n = 0; n <= t; n++) {
+        events_push(t);
+      }
+    }
+
+    for(unsigned t = 0; t < EVENT_TYPES; t++) {
+      CHECK(events_pending());
+      CHECK(events_pop(&e) && e.type == t && e.count == t + 1);
+    }
+    CHECK(!events_pending());
+    CHECK(!events_pop(&e));
+  }
+
+  for(unsigned t = 0; t < EVENT_TYPES; t++) {
+    struct events_stats_t s;
+
+    events_get_stats(t, &s);
+    CHECK(s.occurred == 3 * (t + 1));
+    CHECK(s.coalesced == 3 * t);
+  }
+}
+
+/* Popped, a type can be queued again, behind the others. */
+static void
+test_requeue(void)
+{
+  struct event_t e;
+
+  events_push(EVENT_UART);
+  events_push(EVENT_TIMER);
+  CHECK(events_pop(&e) && e.type == EVENT_UART);
+  events_push(EVENT_UART);
+  CHECK(events_pop(&e) && e.type == EVENT_TIMER);
+  CHECK(events_pop(&e) && e.type == EVENT_UART);
+  CHECK(!events_pop(&e));
+}
+
+/* The time is the first occurrence's, and the wait is kept. */
+static void
+test_time(void)
+{
+  struct event_t e;
+  struct events_stats_t s;
+
+  now = 1000;
+  events_push(EVENT_ACCELEROMETER);
+  now = 1250;
+  events_push(EVENT_ACCELEROMETER);
+  now = 1400;
+  CHECK(events_pop(&e) && e.type == EVENT_ACCELEROMETER);
+  CHECK(e.count == 2 && e.time == 1000);
+
+  events_push(EVENT_ACCELEROMETER);
+  now = 1500;
+  CHECK(events_pop(&e) && e.time == 1400);
+
+  events_get_stats(EVENT_ACCELEROMETER, &s);
+  CHECK(s.latency_max == 400);
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+
+  test_all_types();
+  test_requeue();
+  test_time();
+
+  return sim_done("events");
+}
@@ -0,0 +1,126 @@
+/*
+ * The gesture classifier, driven by accelerometer traces.
+ *
+ * Each trace is in the format the 'trace' command prints: one sample
+ * per line, "x y z tilt", then "dropped N". Lines starting with '#'
+ * are comments, except for one saying what to expect:
+ *
+ *   # expect shake 1 double-tap 0 face-down 0
+ *
+ * Usage: test_gesture TRACE...
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "gesture.h"
+
+/* **************************************** */
+/* gesture_start() and friends drive the device; we feed it directly. */
+
+bool
+mma7660fc_capture_start_script(const struct mma7660fc_reg_t *script)
+{
+  (void)script;
+  return true;
+}
+
+bool
+mma7660fc_capture_stop(void)
+{
+  return true;
+}
+
+bool
+mma7660fc_capture_read(struct mma7660fc_sample_t *sample)
+{
+  (void)sample;
+  return false;
+}
+
+/* **************************************** */
+
+enum { SHAKE, DOUBLE_TAP, FACE_DOWN, KINDS };
+
+static const char *const names[KINDS] = { "shake", "double-tap", "face-down" };
+static const uint8_t bits[KINDS] = { GESTURE_SHAKE, GESTURE_DOUBLE_TAP, GESTURE_FACE_DOWN };
+
+static void
+run_trace(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[128];
+  int expect[KINDS], seen[KINDS] = { 0 };
+  bool have_expect = false;
+  unsigned n = 0;
+
+  if(f == NULL) {
+    perror(path);
+    CHECK(false);
+    return;
+  }
+
+  gesture_reset();
+
+  while(fgets(line, sizeof line, f) != NULL) {
+    int x, y, z, tilt;
+
+    if(line[0] == '#') {
+      if(sscanf(line, "# expect shake %d double-tap %d face-down %d",
+                &expect[SHAKE], &expect[DOUBLE_TAP], &expect[FACE_DOWN]) == KINDS) {
+        have_expect = true;
+      }
+    } else if(sscanf(line, "%d %d %d %d", &x, &y, &z, &tilt) == 4) {
+      struct mma7660fc_sample_t s = { .x = x, .y = y, .z = z, .tilt = tilt };
+      uint8_t g = gesture_feed(&s);
+
+      for(int k = 0; k < KINDS; k++) {
+        if(g & bits[k]) {
+          seen[k]++;
+          printf("%s:%u: %s\n", path, n, names[k]);
+        }
+      }
+      n++;
+    } else if(strncmp(line, "dropped ", 8) != 0) {
+      fprintf(stderr, "%s:%u: can't parse: %s", path, n, line);
+      CHECK(false);
+    }
+  }
+
+  fclose(f);
+
+  if(!have_expect) {
+    fprintf(stderr, "%s: no expectations\n", path);
+    CHECK(false);
+    return;
+  }
+
+  for(int k = 0; k < KINDS; k++) {
+    if(seen[k] != expect[k]) {
+      fprintf(stderr, "%s: %d %s, expected %d\n", path, seen[k], names[k], expect[k]);
+    }
+    CHECK(seen[k] == expect[k]);
+  }
+}
+
+/* **************************************** */
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s TRACE...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for(int i = 1; i < argc; i++) {
+    run_trace(argv[i]);
+  }
+
+  return sim_done("gesture");
+}
@@ -0,0 +1,252 @@
+/*
+ * The SP0256 strobes, on simulated ports.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "sim.h"
+#include "sp0256.h"
+#include "timers.h"
+
+/* **************************************** */
+/* The idle timer is only noted. */
+
+static bool idle_timer;
+
+void
+timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb)
+{
+  (void)ms;
+  (void)period;
+  (void)cb;
+  if(id == TIMER_SP0256_IDLE) {
+    idle_timer = true;
+  }
+}
+
+void
+timer_stop(timer_id_t id)
+{
+  if(id == TIMER_SP0256_IDLE) {
+    idle_timer = false;
+  }
+}
+
+/* **************************************** */
+/* The chip: what the pins looked like at each delay. */
+
+static allophone_t loaded[128];
+static unsigned nloaded;
+static unsigned bad_strobes;
+
+static unsigned resets;     /* RESET held low for long enough. */
+static unsigned power_ups;  /* The supply given time to settle. */
+
+static void
+chip_delay(sim_delay_t kind, double amount)
+{
+  uint8_t ctrl = SP0256_CTRL;
+
+  switch(kind) {
+  case SIM_DELAY_MS:
+    if((ctrl & SP0256_ENABLE) && amount >= SP0256_POWER_MS) {
+      power_ups++;
+    }
+    break;
+
+  case SIM_DELAY_LOOP_1:
+    if(!(ctrl & SP0256_ALD)) {
+      /* Address load: the data lines are sampled on the rising edge. */
+      if(amount < SP0256_ALD_LOOPS || !(ctrl & SP0256_ENABLE) || !(ctrl & SP0256_RESET)) {
+        bad_strobes++;
+      }
+      if(nloaded < sizeof loaded) {
+        loaded[nloaded++] = SP0256_DATA >> 2;
+      }
+    } else if(!(ctrl & SP0256_RESET) && amount >= SP0256_RESET_LOOPS) {
+      resets++;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/* The chip finishes the allophone it is saying: SBY rises, and the
+   pin change interrupt fires. */
+static void
+sby_pulse(void)
+{
+  SP0256_CTRL_IN |= SP0256_SBY;
+  sp0256_isr();
+  SP0256_CTRL_IN &= ~SP0256_SBY;
+}
+
+static void
+chip_reset(void)
+{
+  nloaded = 0;
+  bad_strobes = 0;
+  resets = 0;
+  power_ups = 0;
+}
+
+/* **************************************** */
+
+/* Each SBY rise loads the next allophone, and no sooner. */
+static void
+test_sequence(void)
+{
+  chip_reset();
+
+  speak_allophone(10);
+  CHECK(power_ups == 1 && resets == 1);
+  CHECK(SP0256_CTRL & SP0256_ENABLE);
+  CHECK(SP0256_CTRL & SP0256_RESET);
+  CHECK(SP0256_CTRL & SP0256_ALD);
+  CHECK(nloaded == 1 && loaded[0] == 10);
+
+  speak_allophone(20);
+  speak_allophone(63);
+  CHECK(nloaded == 1);
+  CHECK(sp0256_busy());
+
+  /* A pin change that isn't SBY rising. */
+  sp0256_isr();
+  CHECK(nloaded == 1);
+
+  sby_pulse();
+  CHECK(nloaded == 2 && loaded[1] == 20);
+  sby_pulse();
+  CHECK(nloaded == 3 && loaded[2] == 63);
+  CHECK(!idle_timer);
+
+  /* Done: stay powered, but start the idle timer. */
+  sby_pulse();
+  CHECK(nloaded == 3);
+  CHECK(!sp0256_busy());
+  CHECK(idle_timer);
+  CHECK(SP0256_CTRL & SP0256_ENABLE);
+
+  /* Still on, so no reset this time. */
+  speak_allophone(5);
+  CHECK(resets == 1 && power_ups == 1);
+  CHECK(nloaded == 4 && loaded[3] == 5);
+  CHECK(!idle_timer);
+  sby_pulse();
+
+  CHECK(bad_strobes == 0);
+}
+
+/* A full queue sleeps until SBY makes room. */
+static void
+test_full(void)
+{
+  const unsigned n = SP0256_FIFO_LEN + 10;
+
+  chip_reset();
+  sim_sleep_hook = sby_pulse;
+  sei();
+
+  for(unsigned i = 0; i < n; i++) {
+    speak_allophone(i & 0x3F);
+  }
+  /* One being said, the rest queued. */
+  CHECK(nloaded == n - (SP0256_FIFO_LEN - 1));
+
+  while(sp0256_busy()) {
+    sby_pulse();
+  }
+  CHECK(nloaded == n);
+  for(unsigned i = 0; i < n; i++) {
+    CHECK(loaded[i] == (i & 0x3F));
+  }
+
+  cli();
+  sim_sleep_hook = NULL;
+  CHECK(bad_strobes == 0);
+}
+
+/* With interrupts off it polls SBY instead. */
+static void
+test_full_polled(void)
+{
+  chip_reset();
+  SP0256_CTRL_IN |= SP0256_SBY;
+
+  for(unsigned i = 0; i < SP0256_FIFO_LEN + 10; i++) {
+    speak_allophone(i & 0x3F);
+  }
+  CHECK(nloaded > 10);
+
+  while(sp0256_busy()) {
+    sp0256_isr();
+  }
+  CHECK(nloaded == SP0256_FIFO_LEN + 10);
+
+  SP0256_CTRL_IN &= ~SP0256_SBY;
+}
+
+/* Turning off waits for the queue; cancelling doesn't. */
+static void
+test_off(void)
+{
+  chip_reset();
+
+  speak_allophone(1);
+  speak_allophone(2);
+  sp0256_turn_off();
+  CHECK(SP0256_CTRL & SP0256_ENABLE);
+  sby_pulse();
+  CHECK(SP0256_CTRL & SP0256_ENABLE);
+  sby_pulse();
+  CHECK(!(SP0256_CTRL & SP0256_ENABLE));
+  CHECK(nloaded == 2);
+  CHECK(!idle_timer);
+
+  chip_reset();
+  speak_allophone(1);
+  CHECK(resets == 1);
+  speak_allophone(2);
+  speak_allophone(3);
+  sp0256_cancel();
+  CHECK(!(SP0256_CTRL & (SP0256_ENABLE | SP0256_ALD | SP0256_RESET)));
+  CHECK(!sp0256_busy());
+  sby_pulse();
+  CHECK(nloaded == 1);
+
+  /* And it starts afresh. */
+  speak_allophone(4);
+  CHECK(resets == 2);
+  CHECK(nloaded == 2 && loaded[1] == 4);
+  sby_pulse();
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+  sim_delay_hook = chip_delay;
+  sp0256_init();
+
+  CHECK((SP0256_CTRL_DDR & (SP0256_ALD | SP0256_RESET | SP0256_ENABLE)) == (SP0256_ALD | SP0256_RESET | SP0256_ENABLE));
+  CHECK(!(SP0256_CTRL_DDR & SP0256_SBY));
+  CHECK(SP0256_DATA_DDR == 0xFC);
+
+  test_sequence();
+  test_full();
+  test_full_polled();
+  test_off();
+
+  return sim_done("sp0256");
+}
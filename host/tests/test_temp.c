@@ -0,0 +1,324 @@
+/*
+ * The DS18x20 service against a fake 1-wire bus: the ROM code cache
+ * in EEPROM, resolution, and conversions without waiting.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sim.h"
+#include "crc8.h"
+#include "ds18x20.h"
+#include "onewire.h"
+#include "temp.h"
+#include "timers.h"
+
+/* **************************************** */
+/* The bus. */
+
+#define SENSORS 3
+
+static struct {
+  bool present;
+  uint8_t id[OW_ROMCODE_SIZE];
+  uint8_t sp[DS18X20_SP_SIZE];
+  int16_t decicelsius;
+  unsigned ee_writes;
+} sensors[SENSORS];
+
+static uint8_t power = DS18X20_POWER_EXTERN;
+static unsigned searches, conversions, busy_polls, parasite_off;
+static uint8_t search_next;
+
+static uint32_t timer_ms;
+static unsigned timer_starts;
+
+static void
+add_sensor(uint8_t i, uint8_t family, uint8_t serial, int16_t decicelsius)
+{
+  memset(&sensors[i], 0, sizeof(sensors[i]));
+  sensors[i].present = true;
+  sensors[i].id[0] = family;
+  sensors[i].id[1] = serial;
+  sensors[i].id[7] = crc8(sensors[i].id, 7);
+  sensors[i].sp[DS18B20_CONF_REG] = DS18B20_12_BIT | 0x1F;
+  sensors[i].decicelsius = decicelsius;
+}
+
+static int
+find(const uint8_t *id)
+{
+  for(int i = 0; i < SENSORS; i++) {
+    if(sensors[i].present && memcmp(sensors[i].id, id, OW_ROMCODE_SIZE) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+uint8_t
+ow_rom_search(uint8_t diff, uint8_t *id)
+{
+  if(diff == OW_SEARCH_FIRST) {
+    searches++;
+    search_next = 0;
+  }
+
+  while(search_next < SENSORS && !sensors[search_next].present) {
+    search_next++;
+  }
+  if(search_next == SENSORS) {
+    return OW_PRESENCE_ERR;
+  }
+
+  memcpy(id, sensors[search_next++].id, OW_ROMCODE_SIZE);
+
+  while(search_next < SENSORS && !sensors[search_next].present) {
+    search_next++;
+  }
+
+  return search_next == SENSORS ? OW_LAST_DEVICE : 64;
+}
+
+void
+ow_parasite_disable(void)
+{
+  parasite_off++;
+}
+
+uint8_t
+DS18X20_get_power_status(uint8_t id[])
+{
+  (void)id;
+  return power;
+}
+
+uint8_t
+DS18X20_read_scratchpad(uint8_t id[], uint8_t sp[], uint8_t n)
+{
+  int i = find(id);
+
+  if(i < 0) {
+    return DS18X20_ERROR;
+  }
+  memcpy(sp, sensors[i].sp, n);
+
+  return DS18X20_OK;
+}
+
+uint8_t
+DS18X20_write_scratchpad(uint8_t id[], uint8_t th, uint8_t tl, uint8_t conf)
+{
+  int i = find(id);
+
+  if(i < 0) {
+    return DS18X20_ERROR;
+  }
+  sensors[i].sp[DS18X20_TH_REG] = th;
+  sensors[i].sp[DS18X20_TL_REG] = tl;
+  sensors[i].sp[DS18B20_CONF_REG] = conf | 0x1F;
+
+  return DS18X20_OK;
+}
+
+uint8_t
+DS18X20_scratchpad_to_eeprom(uint8_t with_power_extern, uint8_t id[])
+{
+  int i = find(id);
+
+  (void)with_power_extern;
+  if(i < 0) {
+    return DS18X20_ERROR;
+  }
+  sensors[i].ee_writes++;
+
+  return DS18X20_OK;
+}
+
+uint8_t
+DS18X20_start_meas(uint8_t with_external, uint8_t id[])
+{
+  (void)with_external;
+  (void)id;
+  conversions++;
+
+  return DS18X20_OK;
+}
+
+uint8_t
+DS18X20_conversion_in_progress(void)
+{
+  if(busy_polls > 0) {
+    busy_polls--;
+    return DS18X20_CONVERTING;
+  }
+
+  return DS18X20_CONVERSION_DONE;
+}
+
+uint8_t
+DS18X20_read_decicelsius(uint8_t id[], int16_t *decicelsius)
+{
+  int i = find(id);
+
+  if(i < 0) {
+    return DS18X20_ERROR_CRC;
+  }
+  *decicelsius = sensors[i].decicelsius;
+
+  return DS18X20_OK;
+}
+
+void
+timer_start(timer_id_t id, uint32_t ms, uint32_t period, timer_callback_t cb)
+{
+  (void)period;
+  (void)cb;
+  if(id == TIMER_TEMP) {
+    timer_ms = ms;
+    timer_starts++;
+  }
+}
+
+/* **************************************** */
+
+/* Nothing cached: search, and remember what we found. */
+static void
+test_cold_boot(void)
+{
+  CHECK(temp_init());
+  CHECK(searches == 1);
+  CHECK(temp_count() == 2);
+
+  /* The next boot finds them in EEPROM. */
+  CHECK(temp_init());
+  CHECK(searches == 1);
+  CHECK(temp_count() == 2);
+}
+
+/* A cached sensor that doesn't answer sends us back to searching, and
+   the cache follows the bus. */
+static void
+test_stale_cache(void)
+{
+  sensors[1].present = false;
+  add_sensor(2, DS18B20_FAMILY_CODE, 3, 190);
+
+  CHECK(temp_init());
+  CHECK(searches == 2);
+  CHECK(temp_count() == 2);
+
+  CHECK(temp_init());
+  CHECK(searches == 2);
+}
+
+/* Erased EEPROM isn't a cache. */
+static void
+test_erased(void)
+{
+  unsigned s = searches;
+
+  sim_reset();
+  CHECK(temp_init());
+  CHECK(searches == s + 1);
+}
+
+/* Half a degree is 9 bits, set once and kept in the sensor's EEPROM. */
+static void
+test_precision(void)
+{
+  CHECK((sensors[0].sp[DS18B20_CONF_REG] & DS18B20_RES_MASK) == DS18B20_9_BIT);
+  CHECK(sensors[0].ee_writes == 1);
+
+  CHECK(temp_set_precision(5000));
+  CHECK(sensors[0].ee_writes == 1);
+
+  CHECK(temp_set_precision(625));
+  CHECK((sensors[0].sp[DS18B20_CONF_REG] & DS18B20_RES_MASK) == DS18B20_12_BIT);
+  CHECK(sensors[0].ee_writes == 2);
+
+  CHECK(temp_set_precision(1250));
+  CHECK((sensors[0].sp[DS18B20_CONF_REG] & DS18B20_RES_MASK) == DS18B20_11_BIT);
+
+  CHECK(temp_set_precision(TEMP_PRECISION_DEFAULT));
+}
+
+/* Start, sleep until the deadline, read. A sensor still busy gets a
+   little longer. */
+static void
+test_conversion(void)
+{
+  int16_t t;
+  unsigned c = conversions;
+
+  CHECK(temp_start());
+  CHECK(conversions == c + 1);
+  CHECK(timer_ms == TEMP_MARGIN(DS18B20_TCONV_9BIT));
+
+  /* Already going: no second conversion. */
+  CHECK(temp_start());
+  CHECK(conversions == c + 1);
+  CHECK(!temp_search());
+
+  busy_polls = 1;
+  CHECK(!temp_timer());
+  CHECK(timer_ms == TEMP_RETRY_MS);
+
+  CHECK(temp_timer());
+  CHECK(temp_get(0, &t) && t == 215);
+  CHECK(temp_get(1, &t) && t == 190);
+  CHECK(!temp_get(2, &t));
+
+  /* Nothing outstanding. */
+  CHECK(!temp_timer());
+}
+
+/* A DS18S20 is always 750ms, and sets the pace for everyone. A
+   parasite-powered bus can't be polled. */
+static void
+test_parasite(void)
+{
+  int16_t t;
+
+  add_sensor(1, DS18S20_FAMILY_CODE, 4, -55);
+  power = DS18X20_POWER_PARASITE;
+  CHECK(temp_search());
+  CHECK(temp_count() == 3);
+  CHECK(sensors[1].ee_writes == 0);
+
+  CHECK(temp_start());
+  CHECK(timer_ms == TEMP_MARGIN(DS18S20_TCONV));
+
+  busy_polls = 1;
+  CHECK(temp_timer());
+  CHECK(parasite_off == 1);
+  CHECK(temp_get(0, &t) && t == 215);
+  CHECK(temp_get(1, &t) && t == -55);
+  CHECK(temp_get(2, &t) && t == 190);
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+
+  add_sensor(0, DS18B20_FAMILY_CODE, 1, 215);
+  add_sensor(1, DS18B20_FAMILY_CODE, 2, 190);
+
+  test_cold_boot();
+  test_stale_cache();
+  test_erased();
+  test_precision();
+  test_conversion();
+  test_parasite();
+
+  return sim_done("temp");
+}
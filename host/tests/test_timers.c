@@ -0,0 +1,268 @@
+/*
+ * Software timers against a simulated WDT and Timer2.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "sim.h"
+#include "events.h"
+#include "sp0256.h"
+#include "temp.h"
+#include "timebase.h"
+#include "timers.h"
+
+void TIMER2_COMPA_vect(void);
+
+/* timebase.c wants to switch the square wave on and off. */
+bool
+ds1307_sqw(bool on)
+{
+  (void)on;
+  return false;
+}
+
+/* **************************************** */
+/* The hardware, in 1ms steps. */
+
+static uint32_t real_ms;
+
+static unsigned wdt_resets_seen;
+static uint32_t wdt_us, fine_us;
+static unsigned ticks, fine_ticks;
+
+/* When each timer last fired. */
+static uint32_t fired_at[TIMERS];
+static unsigned fired[TIMERS];
+
+static uint32_t
+wdt_period_us(void)
+{
+  uint8_t n = (WDTCSR & 0x7) | ((WDTCSR & _BV(WDP3)) ? 8 : 0);
+
+  return 16000UL << n;
+}
+
+static void
+collect(void)
+{
+  struct event_t e;
+
+  while(events_pop(&e)) {
+    if(e.type == EVENT_TIMER) {
+      uint8_t t = timers_expired();
+
+      for(uint8_t i = 0; i < TIMERS; i++) {
+        if(t & _BV(i)) {
+          fired_at[i] = real_ms;
+          fired[i]++;
+        }
+      }
+    }
+  }
+}
+
+static void
+run(uint32_t ms)
+{
+  while(ms-- > 0) {
+    real_ms++;
+
+    if(sim_wdt_resets != wdt_resets_seen) {
+      wdt_resets_seen = sim_wdt_resets;
+      wdt_us = 0;
+    }
+    if(TCCR2B == 0) {
+      fine_us = 0;
+    }
+    /* Nothing is left pending, the interrupt is taken at once. */
+    TIFR2 = 0;
+
+    wdt_us += 1000;
+    if(TCCR2B != 0) {
+      fine_us += 1000;
+      /* Timer2's real period, not TIMEBASE_FINE_US. */
+      if(fine_us >= (OCR2A + 1UL) * 1024 * 1000000 / F_CPU) {
+        fine_us -= (OCR2A + 1UL) * 1024 * 1000000 / F_CPU;
+        TCNT2 = fine_us * (F_CPU / 1000000) / 1024;
+        fine_ticks++;
+        TIMER2_COMPA_vect();
+      } else {
+        TCNT2 = fine_us * (F_CPU / 1000000) / 1024;
+      }
+    }
+    if((WDTCSR & _BV(WDIE)) && wdt_us >= wdt_period_us()) {
+      wdt_us = 0;
+      ticks++;
+      timers_isr();
+    }
+
+    collect();
+  }
+}
+
+/* **************************************** */
+
+/* A short timer started mid-period is met on time, and the WDT is
+   left alone. */
+static void
+test_short(void)
+{
+  unsigned resets;
+  uint32_t start;
+
+  /* The housekeeping is first due on the first tick. */
+  run(TIMER_HOUSEKEEPING_MS);
+  CHECK(ticks == 1);
+  CHECK(fired[TIMER_HOUSEKEEPING] == 1);
+  CHECK(fired_at[TIMER_HOUSEKEEPING] == TIMER_HOUSEKEEPING_MS);
+
+  run(1000);
+  resets = sim_wdt_resets;
+  start = real_ms;
+  timer_start(TIMER_TEMP, 106, 0, NULL);
+  CHECK(timebase_fine_running());
+  CHECK(sim_wdt_resets == resets);
+
+  run(200);
+  CHECK(fired[TIMER_TEMP] == 1);
+  CHECK(fired_at[TIMER_TEMP] - start >= 106);
+  CHECK(fired_at[TIMER_TEMP] - start <= 106 + 17);
+  CHECK(!timebase_fine_running());
+}
+
+/* Lots of short timers don't slow timers_now() or the housekeeping. */
+static void
+test_no_loss(void)
+{
+  unsigned housekeeping = fired[TIMER_HOUSEKEEPING];
+  unsigned t0 = ticks;
+
+  for(unsigned i = 0; i < 600; i++) {
+    timer_start(TIMER_TEMP, 106, 0, NULL);
+    run(100);
+    CHECK(timers_now() <= real_ms);
+    CHECK(real_ms - timers_now() <= TIMER_HOUSEKEEPING_MS);
+  }
+
+  /* Sixty seconds: seven housekeepings, whatever the phase. */
+  CHECK(fired[TIMER_HOUSEKEEPING] - housekeeping >= 7);
+  CHECK(ticks > t0);
+}
+
+/* At each tick, timers_now() is exactly right. */
+static void
+test_now(void)
+{
+  for(unsigned i = 0; i < 100; i++) {
+    unsigned t = ticks;
+
+    timer_start(TIMER_SP0256_IDLE, 37 * i % 5000 + 1, 0, NULL);
+    while(ticks == t) {
+      run(1);
+    }
+    CHECK(timers_now() == real_ms);
+  }
+}
+
+/* A timer kept being restarted (as serial traffic does to the UART
+   one) fires once it's left alone, on time. */
+static void
+test_restart(void)
+{
+  unsigned n = fired[TIMER_UART_IDLE];
+  uint32_t last;
+
+  for(unsigned i = 0; i < 200; i++) {
+    timer_start(TIMER_UART_IDLE, TIMER_UART_IDLE_MS, 0, NULL);
+    last = real_ms;
+    run(37);
+  }
+  CHECK(fired[TIMER_UART_IDLE] == n);
+
+  run(TIMER_UART_IDLE_MS + 100);
+  CHECK(fired[TIMER_UART_IDLE] == n + 1);
+  CHECK(fired_at[TIMER_UART_IDLE] - last >= TIMER_UART_IDLE_MS);
+  CHECK(fired_at[TIMER_UART_IDLE] - last <= TIMER_UART_IDLE_MS + 17);
+}
+
+/* A stopped timer doesn't fire, and doesn't keep Timer2 going. */
+static void
+test_stop(void)
+{
+  unsigned n = fired[TIMER_TEMP];
+
+  timer_start(TIMER_TEMP, 500, 0, NULL);
+  run(100);
+  timer_stop(TIMER_TEMP);
+  run(9000);
+  CHECK(fired[TIMER_TEMP] == n);
+  CHECK(!timebase_fine_running());
+}
+
+/* What an announcement and a conversion cost in Timer2 interrupts,
+   started mid-period as they are. Switching the SP0256 off can wait
+   for the WDT; a 12-bit conversion costs its length in fine ticks,
+   unless the WDT period is short enough to wait for. */
+static void
+test_cycle(void)
+{
+  unsigned n = fired[TIMER_SP0256_IDLE];
+  uint32_t tconv = TEMP_MARGIN(DS18B20_TCONV_12BIT);
+  uint32_t start;
+  unsigned f;
+
+  run(3000);
+  f = fine_ticks;
+  start = real_ms;
+  timer_start(TIMER_SP0256_IDLE, SP0256_IDLE_MS, 0, NULL);
+  CHECK(!timebase_fine_running());
+
+  run(SP0256_IDLE_MS + 8192 + 100);
+  CHECK(fired[TIMER_SP0256_IDLE] == n + 1);
+  CHECK(fired_at[TIMER_SP0256_IDLE] - start >= SP0256_IDLE_MS);
+  CHECK(fired_at[TIMER_SP0256_IDLE] - start <= SP0256_IDLE_MS + 8192 + 17);
+  CHECK(fine_ticks == f);
+
+  n = fired[TIMER_TEMP];
+  f = fine_ticks;
+  start = real_ms;
+  timer_start(TIMER_TEMP, tconv, 0, NULL);
+
+  run(tconv + 1100);
+  CHECK(fired[TIMER_TEMP] == n + 1);
+  CHECK(fired_at[TIMER_TEMP] - start >= tconv);
+  CHECK(fired_at[TIMER_TEMP] - start <= tconv + 1000 + 17);
+  CHECK(fine_ticks - f <= tconv * 1000 / TIMEBASE_FINE_US + 1);
+  CHECK(!timebase_fine_running());
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+
+  timer_start(TIMER_HOUSEKEEPING, TIMER_HOUSEKEEPING_MS, TIMER_HOUSEKEEPING_MS, NULL);
+  timers_init();
+  CHECK(!timebase_fine_running());
+
+  test_short();
+  test_no_loss();
+  test_now();
+  test_restart();
+  test_stop();
+  test_cycle();
+
+  CHECK(timers_epoch() == 0);
+
+  return sim_done("timers");
+}
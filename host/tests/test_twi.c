@@ -0,0 +1,309 @@
+/*
+ * The TWI driver against a fake slave on a simulated bus.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/twi.h>
+
+#include "sim.h"
+#include "TWI.h"
+
+void TWI_vect(void);
+void TIMER0_OVF_vect(void);
+
+#define SLAVE 0xD0
+
+/* **************************************** */
+/* The slave: a register file with a pointer, like the DS1307. */
+
+static struct {
+  enum { BUS_IDLE, BUS_ADDR, BUS_WRITE, BUS_READ } phase;
+  bool pointer_next;
+  uint8_t pointer;
+  uint8_t regs[64];
+
+  uint8_t nacks;  /* Refuse the next this many addressings. */
+  bool stuck;     /* Hold the bus: nothing more happens. */
+} slave;
+
+static unsigned sleeps;
+
+/* The MCU sleeps until the TWI (or Timer0) interrupts. The last write
+   to TWCR says what the master asked the bus to do next. */
+static void
+bus_step(void)
+{
+  uint8_t cr = TWCR;
+  uint8_t status;
+
+  sleeps++;
+
+  if(slave.stuck) {
+    TIMER0_OVF_vect();
+    return;
+  }
+
+  if(cr & _BV(TWSTA)) {
+    status = slave.phase == BUS_WRITE ? TW_REP_START : TW_START;
+    slave.phase = BUS_ADDR;
+  } else {
+    switch(slave.phase) {
+    case BUS_ADDR:
+      if((TWDR & ~TW_READ) != SLAVE || slave.nacks > 0) {
+        if(slave.nacks > 0) {
+          slave.nacks--;
+        }
+        status = TWDR & TW_READ ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+        slave.phase = BUS_IDLE;
+      } else if(TWDR & TW_READ) {
+        status = TW_MR_SLA_ACK;
+        slave.phase = BUS_READ;
+      } else {
+        status = TW_MT_SLA_ACK;
+        slave.phase = BUS_WRITE;
+        slave.pointer_next = true;
+      }
+      break;
+
+    case BUS_WRITE:
+      if(slave.pointer_next) {
+        slave.pointer = TWDR;
+        slave.pointer_next = false;
+      } else {
+        slave.regs[slave.pointer++ % sizeof slave.regs] = TWDR;
+      }
+      status = TW_MT_DATA_ACK;
+      break;
+
+    case BUS_READ:
+      TWDR = slave.regs[slave.pointer++ % sizeof slave.regs];
+      status = cr & _BV(TWEA) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+      break;
+
+    default:
+      status = TW_BUS_ERROR;
+      break;
+    }
+  }
+
+  TWSR = status;
+  TWCR = cr | _BV(TWINT);
+  TWI_vect();
+}
+
+/* **************************************** */
+/* The pins, as seen by TWI_recover(), and the time spent backing off. */
+
+#define SCL _BV(PC5)
+#define SDA _BV(PC4)
+
+static uint8_t lines[64];  /* DDRC & (SCL | SDA) at each _delay_us(). */
+static uint8_t nlines;
+static unsigned backoff_ms;
+
+static void
+bus_delay(sim_delay_t kind, double amount)
+{
+  switch(kind) {
+  case SIM_DELAY_US:
+    if(nlines < sizeof lines) {
+      lines[nlines++] = DDRC & (SCL | SDA);
+    }
+    break;
+
+  case SIM_DELAY_MS:
+    backoff_ms += amount;
+    /* Whatever was on the bus has been STOPped. */
+    slave.phase = BUS_IDLE;
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void
+bus_reset(void)
+{
+  slave.phase = BUS_IDLE;
+  slave.nacks = 0;
+  slave.stuck = false;
+  nlines = 0;
+  backoff_ms = 0;
+}
+
+static struct TWI_stats_t
+stats(void)
+{
+  struct TWI_stats_t s = { 0 };
+
+  CHECK(TWI_get_stats(0, &s) && s.addr == SLAVE);
+  return s;
+}
+
+/* **************************************** */
+
+static void
+test_read_write(void)
+{
+  const uint8_t out[3] = { 0x12, 0x34, 0x56 };
+  uint8_t in[4] = { 0 };
+
+  bus_reset();
+  CHECK(TWI_write_regs(SLAVE, 5, out, sizeof out));
+  CHECK(slave.regs[5] == 0x12 && slave.regs[6] == 0x34 && slave.regs[7] == 0x56);
+
+  slave.regs[8] = 0x78;
+  bus_reset();
+  CHECK(TWI_read_regs(SLAVE, 5, in, sizeof in));
+  CHECK(in[0] == 0x12 && in[1] == 0x34 && in[2] == 0x56 && in[3] == 0x78);
+
+  CHECK(!TWI_busy());
+  CHECK(stats().errors == 0);
+}
+
+/* A device that is busy for a while is retried, backing off. */
+static void
+test_retry(void)
+{
+  struct TWI_stats_t before = stats(), after;
+  uint8_t in;
+
+  bus_reset();
+  slave.nacks = 2;
+  slave.regs[0] = 0x42;
+  CHECK(TWI_read_regs(SLAVE, 0, &in, 1));
+  CHECK(in == 0x42);
+
+  after = stats();
+  CHECK(after.transactions - before.transactions == 3);
+  CHECK(after.errors - before.errors == 2);
+  CHECK(after.retries - before.retries == 2);
+  CHECK(backoff_ms == TWI_BACKOFF_MS + 2 * TWI_BACKOFF_MS);
+}
+
+/* One that never answers is given up on after TWI_MAX_TRIES. */
+static void
+test_give_up(void)
+{
+  struct TWI_stats_t before = stats(), after;
+  uint8_t in;
+
+  bus_reset();
+  slave.nacks = 255;
+  CHECK(!TWI_read_regs(SLAVE, 0, &in, 1));
+
+  after = stats();
+  CHECK(after.errors - before.errors == TWI_MAX_TRIES);
+  CHECK(after.retries - before.retries == TWI_MAX_TRIES - 1);
+  CHECK(backoff_ms == TWI_BACKOFF_MS * ((1 << (TWI_MAX_TRIES - 1)) - 1));
+}
+
+/* A slave holding the bus times out, and we clock it free. */
+static void
+test_timeout_recover(void)
+{
+  struct TWI_stats_t before = stats(), after;
+  uint8_t in;
+  struct TWI_txn_t txn = {
+    .addr = SLAVE,
+    .reg = 0,
+    .rbuf = &in,
+    .rlen = 1,
+  };
+  uint8_t pulses = 0;
+
+  bus_reset();
+  slave.stuck = true;
+  CHECK(TWI_submit(&txn));
+  CHECK(!TWI_wait(&txn));
+  CHECK(txn.status == TWI_TIMEOUT);
+  CHECK(!TWI_busy());
+
+  after = stats();
+  CHECK(after.timeouts - before.timeouts == 1);
+
+  /* Nine clocks with SDA released... */
+  for(uint8_t i = 0; i + 1 < nlines && !(lines[i] & SDA); i += 2) {
+    if(lines[i] == SCL && lines[i + 1] == 0) {
+      pulses++;
+    }
+  }
+  CHECK(pulses == 9);
+
+  /* ... then a STOP: SDA rises while SCL is high... */
+  CHECK(nlines == 2 * 9 + 3);
+  CHECK(lines[18] == (SCL | SDA));
+  CHECK(lines[19] == SDA);
+  CHECK(lines[20] == 0);
+
+  /* ... and the bus works again. */
+  bus_reset();
+  slave.regs[0] = 0x99;
+  CHECK(TWI_read_regs(SLAVE, 0, &in, 1) && in == 0x99);
+}
+
+/* Draining the queue sleeps until the transaction is done. */
+static void
+test_drain(void)
+{
+  const uint8_t out[2] = { 0x11, 0x22 };
+  struct TWI_txn_t txn = {
+    .addr = SLAVE,
+    .reg = 10,
+    .wbuf = out,
+    .wlen = sizeof out,
+  };
+  unsigned before = sleeps;
+
+  bus_reset();
+  CHECK(TWI_submit(&txn));
+  TWI_drain();
+  CHECK(!TWI_busy());
+  CHECK(txn.status == TWI_DONE);
+  CHECK(slave.regs[10] == 0x11 && slave.regs[11] == 0x22);
+  CHECK(sleeps - before == 2 + sizeof out + 1);
+}
+
+/* The bit rate rounds down, never up, but no further than it must. */
+static void
+test_speed(void)
+{
+  for(unsigned long scl = 1000; scl <= 27000; scl += 50) {
+    uint16_t speed = TWI_SPEED(scl);
+    unsigned long step = 2UL << (2 * (speed >> 8));
+    unsigned long div = 16 + (speed & 0xFF) * step;
+
+    CHECK(F_CPU <= scl * div);
+    CHECK((speed & 0xFF) == TWI_TWBR_MIN || F_CPU > scl * (div - step));
+  }
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+  sim_sleep_hook = bus_step;
+  sim_delay_hook = bus_delay;
+
+  TWI_set_default_speed(TWI_SPEED(100000UL));
+  sei();
+
+  test_read_write();
+  test_retry();
+  test_give_up();
+  test_timeout_recover();
+  test_drain();
+  test_speed();
+
+  return sim_done("twi");
+}
@@ -0,0 +1,191 @@
+/*
+ * The UART FIFOs, driven through simulated registers.
+ *
+ * Built once for each UART_RX_OVERFLOW policy.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "sim.h"
+#include "uart.h"
+
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+
+#define TX_FIFO_LEN 64
+
+/* **************************************** */
+
+static void
+receive(uint8_t c, uint8_t status)
+{
+  UCSR0A = status | _BV(RXC0);
+  UDR0 = c;
+  USART_RX_vect();
+}
+
+static void
+drain_rx(void)
+{
+  uint8_t c;
+
+  while(uart_rx(&c))
+    ;
+}
+
+/* Many times round the ring, never full. */
+static void
+test_rx_wrap(void)
+{
+  uint8_t c;
+
+  for(unsigned i = 0; i < 5 * UART_RX_FIFO_LEN; i++) {
+    receive(i, 0);
+    receive(~i, 0);
+    CHECK(uart_rx(&c) && c == (uint8_t)i);
+    CHECK(uart_rx(&c) && c == (uint8_t)~i);
+  }
+
+  CHECK(!uart_rx_pending());
+  CHECK(!uart_rx(&c));
+}
+
+/* A ring of N slots holds N - 1 characters. */
+static void
+test_rx_overflow(void)
+{
+  struct uart_stats_t before, after;
+  uint8_t c;
+
+  drain_rx();
+  uart_get_stats(&before);
+
+  for(unsigned i = 0; i < UART_RX_FIFO_LEN + 2; i++) {
+    receive('a' + i, 0);
+  }
+
+  uart_get_stats(&after);
+  CHECK(after.rx_dropped - before.rx_dropped == 3);
+
+  for(unsigned i = 0; i < UART_RX_FIFO_LEN - 1; i++) {
+#if UART_RX_OVERFLOW == UART_RX_DROP_OLDEST
+    CHECK(uart_rx(&c) && c == 'a' + 3 + i);
+#else
+    CHECK(uart_rx(&c) && c == 'a' + i);
+#endif
+  }
+  CHECK(!uart_rx(&c));
+}
+
+static void
+test_rx_errors(void)
+{
+  struct uart_stats_t before, after;
+  uint8_t c;
+
+  drain_rx();
+  uart_get_stats(&before);
+
+  /* A framing error means the character is garbage. */
+  receive('x', _BV(FE0));
+  CHECK(!uart_rx_pending());
+
+  /* An overrun lost the one before, but this one is good. */
+  receive('y', _BV(DOR0));
+  CHECK(uart_rx(&c) && c == 'y');
+
+  uart_get_stats(&after);
+  CHECK(after.rx_framing - before.rx_framing == 1);
+  CHECK(after.rx_overrun - before.rx_overrun == 1);
+  CHECK(after.rx_dropped == before.rx_dropped);
+}
+
+/* **************************************** */
+
+/* With interrupts on, the FIFO fills and the UDRE interrupt empties it. */
+static void
+test_tx_interrupts(void)
+{
+  unsigned sent = 0;
+
+  sei();
+  UCSR0A = 0;
+  UCSR0B = 0;
+
+  /* Twice round, so the second pass wraps. */
+  for(unsigned pass = 0; pass < 2; pass++) {
+    unsigned queued = 0;
+
+    while(uart_tx_nb(queued + pass)) {
+      queued++;
+    }
+    CHECK(queued == TX_FIFO_LEN - 1);
+    CHECK(UCSR0B & _BV(UDRIE0));
+
+    for(sent = 0; UCSR0B & _BV(UDRIE0); sent++) {
+      USART_UDRE_vect();
+      CHECK(UDR0 == (uint8_t)(sent + pass));
+    }
+    CHECK(sent == TX_FIFO_LEN - 1);
+
+    /* There is room again. */
+    CHECK(uart_tx_nb('z'));
+    USART_UDRE_vect();
+    CHECK(UDR0 == 'z');
+    CHECK(!(UCSR0B & _BV(UDRIE0)));
+  }
+
+  cli();
+}
+
+/* With interrupts off, uart_tx() and uart_tx_flush() drain it by hand. */
+static void
+test_tx_polling(void)
+{
+  unsigned i;
+
+  cli();
+  UCSR0A = 0;
+
+  for(i = 0; i < TX_FIFO_LEN - 1; i++) {
+    uart_tx(i);
+  }
+  CHECK(!uart_tx_nb('!'));
+
+  /* The data register empties, so the next one gets in. */
+  UCSR0A = _BV(UDRE0);
+  uart_tx('!');
+  CHECK(UDR0 == 0);
+
+  uart_tx_flush();
+  CHECK(UDR0 == '!');
+  CHECK(!(UCSR0B & _BV(UDRIE0)));
+  CHECK(UCSR0A & _BV(TXC0));
+}
+
+/* **************************************** */
+
+int
+main(void)
+{
+  sim_reset();
+
+  test_rx_wrap();
+  test_rx_overflow();
+  test_rx_errors();
+
+  test_tx_interrupts();
+  test_tx_polling();
+
+#if UART_RX_OVERFLOW == UART_RX_DROP_OLDEST
+  return sim_done("uart (drop oldest)");
+#else
+  return sim_done("uart (drop newest)");
+#endif
+}
@@ -0,0 +1,90 @@
+/*
+ * Binary framing for the clock's serial port, shared by the AVR and
+ * host sides.
+ *
+ * Licenced under CC0 v1.0
+ * https://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+
+/*
+ * A frame is
+ *
+ *   SOF LEN OPCODE SEQ PAYLOAD[LEN] CRC
+ *
+ * where the CRC is the Dallas/Maxim CRC-8 (avr/crc8.c) of LEN, OPCODE,
+ * SEQ and the payload. SOF isn't ASCII, so frames and text commands can
+ * share the line: the clock treats SOF anywhere outside a frame as the
+ * start of one, dropping any half-typed command. A frame that stops
+ * for FRAME_TIMEOUT_MS (avr/frame.h) part way is dropped too.
+ * Multi-byte numbers are little-endian.
+ *
+ * The clock sleeps with its UART off, and the character that wakes it
+ * is lost. The host sends a newline first and gives it a moment, see
+ * host/clocklink.c.
+ *
+ * The clock answers each frame with one whose opcode has FRAME_REPLY
+ * set, with the same SEQ, and whose first payload byte is a
+ * frame_status_t. SEQ is the host's to choose, so it can tell a late
+ * reply to an earlier request from the one it's waiting for. Text (e.g.
+ * debugging output) may appear between frames; skip to SOF.
+ */
+
+#define FRAME_SOF          0xA5
+#define FRAME_MAX_PAYLOAD  32
+#define FRAME_OVERHEAD     5
+#define FRAME_REPLY        0x80
+
+/* Only the gets are safe to send twice: the rest change things, and
+   alarms go by index. */
+typedef enum {
+  FRAME_PING          = 0x00,   /* Echoes the payload. */
+  FRAME_GET_TIME      = 0x01,   /* -> struct frame_time_t */
+  FRAME_SET_TIME      = 0x02,   /* struct frame_time_t -> */
+  FRAME_GET_ALARMS    = 0x03,   /* -> struct frame_alarm_t[] */
+  FRAME_SET_ALARM     = 0x04,   /* struct frame_alarm_t -> */
+  FRAME_CLEAR_ALARM   = 0x05,   /* index -> */
+  FRAME_GET_STATS     = 0x06,   /* -> struct frame_stats_t */
+  FRAME_SPEAK         = 0x07    /* allophones -> */
+} frame_opcode_t;
+
+typedef enum {
+  FRAME_OK            = 0x00,
+  FRAME_FAILED        = 0x01,   /* The request was understood but didn't work. */
+  FRAME_BAD_CRC       = 0x02,
+  FRAME_BAD_REQUEST   = 0x03    /* Unknown opcode or wrong length. */
+} frame_status_t;
+
+/* Payloads, byte by byte. */
+
+struct frame_time_t {
+  uint8_t hours;
+  uint8_t minutes;
+  uint8_t seconds;
+  uint8_t day;
+  uint8_t date;
+  uint8_t month;
+  uint8_t year;
+  uint8_t twelve_hour;
+};
+
+struct frame_alarm_t {
+  uint8_t hours;
+  uint8_t minutes;
+  uint8_t days;
+};
+
+struct frame_stats_t {
+  uint8_t rx_dropped[2];
+  uint8_t rx_overrun[2];
+  uint8_t rx_framing[2];
+  uint8_t clock_ppm[4];
+  uint8_t clock_error_ms[4];
+  uint8_t clock_syncs[2];
+};
+
+#endif /* _FRAME_H_ */